@@ -1,19 +1,35 @@
 #include "ActorManager.h"
 
+// Action lookups and queueing are logged at warn level on failure
+static LogModule actorLog("ActorManager");
+
 // Initialize static variables
 std::vector<Actor*> ActorManager::actors;
-QueueHandle_t ActorManager::actionQueue = xQueueCreate(15, sizeof(ActorManager::actionCall));
+std::vector<SemaphoreHandle_t> ActorManager::actorLocks;
+QueueHandle_t ActorManager::actionQueue = xQueueCreate(ActorManager::actionQueueLength, sizeof(ActorManager::actionCall));
+std::priority_queue<ActorManager::actionCall, std::vector<ActorManager::actionCall>, ActorManager::dueLater> ActorManager::timedActions;
 TaskHandle_t ActorManager::actionHandle = nullptr;
 SemaphoreHandle_t ActorManager::taskMutex = xSemaphoreCreateMutex();
+ActorManager::actionResult ActorManager::results[ActorManager::resultCapacity];
+SemaphoreHandle_t ActorManager::resultMutex = xSemaphoreCreateMutex();
+uint32_t ActorManager::nextTicket = 1;
 bool ActorManager::noActors = true;
 
 /// @brief Adds an actor to the in-use list
 /// @param actor A pointer to the actor to add
 /// @return True on success
 bool ActorManager::addActor(Actor* actor) {
+	// Recursive so an actor can trigger its own actions from within an action
+	SemaphoreHandle_t lock = xSemaphoreCreateRecursiveMutex();
+	if (lock == NULL) {
+		LOG_ERROR(actorLog, "Could not create lock for %s", actor->Description.name.c_str());
+		return false;
+	}
 	// Add receiver to in-use list
 	actors.push_back(actor);
-	return true; // Currently no way to fail this
+	actorLocks.push_back(lock);
+	ResponseCache::invalidate();
+	return true;
 }
 
 /// @brief Calls the begin function on all the in-use actors
@@ -21,7 +37,7 @@ bool ActorManager::addActor(Actor* actor) {
 bool ActorManager::beginActors() {
 	// Ensure queue was created
 	if (actionQueue == NULL) {
-		xQueueCreate(15, sizeof(ActorManager::actionCall));
+		xQueueCreate(ActorManager::actionQueueLength, sizeof(ActorManager::actionCall));
 		if (actionQueue == NULL) {
 			return false;
 		}
@@ -34,17 +50,27 @@ bool ActorManager::beginActors() {
 			return false;
 		}
 	}
+
+	// Ensure result mutex was created
+	if (resultMutex == NULL) {
+		resultMutex = xSemaphoreCreateMutex();
+		if (resultMutex == NULL) {
+			return false;
+		}
+	}
 	if (!actors.empty()) {
 		noActors = false;
 		for (auto const &a : actors) {
 			if (!a->begin()) {
-				Logger.println("Could not start " + a->Description.name);
+				LOG_ERROR(actorLog, "Could not start %s", a->Description.name.c_str());
 				return false;
 			} else {
-				Logger.println("Started " + a->Description.name);
+				LOG_INFO(actorLog, "Started %s", a->Description.name.c_str());
 			}
 		}
 	}
+	// Descriptions are complete once actors have started
+	ResponseCache::invalidate();
 	return true;
 }
 
@@ -52,96 +78,163 @@ bool ActorManager::beginActors() {
 /// @param actor The name of the actor
 /// @param action The name of the action
 /// @param payload An optional JSON string for data payload
-/// @return True on success
-bool ActorManager::addActionToQueue(String actor, String action, String payload) {
+/// @param delay An optional delay, in ms, before the action is processed
+/// @return The ticket used to retrieve the action result, 0 on failure
+uint32_t ActorManager::addActionToQueue(String actor, String action, String payload, ulong delay) {
 	// Attempt to convert actor name to ID
 	int actorPosID = actorNameToID(actor);
 	if (actorPosID == -1) {
-		return false;
+		return 0;
 	}
 
 	// Attempt to convert action name to ID
 	int action_id = actionNameToID(action, actorPosID);
 	if (action_id == -1) {
-		return false;
+		return 0;
 	}
 
 	// Attempt to add action to queue
-	return addActionToQueue(actorPosID, action_id, payload);
+	return addActionToQueue(actorPosID, action_id, payload, delay);
 }
 
 /// @brief Adds an action to the queue for processing
 /// @param actorPosID The position ID of the actor
 /// @param action The name of the action
 /// @param payload An optional JSON string for data payload
-/// @return True on success
-bool ActorManager::addActionToQueue(int actorPosID, String action, String payload) {
+/// @param delay An optional delay, in ms, before the action is processed
+/// @return The ticket used to retrieve the action result, 0 on failure
+uint32_t ActorManager::addActionToQueue(int actorPosID, String action, String payload, ulong delay) {
 	// Check if actor exists
 	if(actorPosID < 0 || actorPosID >= actors.size()) {
-		Logger.println("Actor position ID out of range");
-		return false;
+		LOG_WARN(actorLog, "Actor position ID out of range");
+		return 0;
 	}
 
 	// Attempt to convert action name to ID
 	int action_id = actionNameToID(action, actorPosID);
 	if (action_id == -1) {
-		return false;
+		return 0;
 	}
 
 	// Attempt to add action to queue
-	return addActionToQueue(actorPosID, action_id, payload);
+	return addActionToQueue(actorPosID, action_id, payload, delay);
 }
 
 /// @brief Adds an action to the queue for processing
 /// @param actor The name of the actor
 /// @param actionID The ID of the action
 /// @param payload An optional JSON string for data payload
-/// @return True on success
-bool ActorManager::addActionToQueue(String actor, int actionID, String payload) {
+/// @param delay An optional delay, in ms, before the action is processed
+/// @return The ticket used to retrieve the action result, 0 on failure
+uint32_t ActorManager::addActionToQueue(String actor, int actionID, String payload, ulong delay) {
 	// Attempt to convert actor name to ID
 	int actorPosID = actorNameToID(actor);
 	if (actorPosID == -1) {
-		return false;
+		return 0;
 	}
 
 	// Attempt to add action to queue
-	return addActionToQueue(actorPosID, actionID, payload);
+	return addActionToQueue(actorPosID, actionID, payload, delay);
 }
 
 /// @brief Adds an action to the queue for processing
 /// @param actorPosID The position ID of the actor
 /// @param actionID The ID of the action
 /// @param payload An optional JSON string for data payload
-/// @return True on success
-bool ActorManager::addActionToQueue(int actorPosID, int actionID, String payload) {
+/// @param delay An optional delay, in ms, before the action is processed
+/// @return The ticket used to retrieve the action result, 0 on failure
+uint32_t ActorManager::addActionToQueue(int actorPosID, int actionID, String payload, ulong delay) {
 	// Check if actor exists
 	if(actorPosID < 0 || actorPosID >= actors.size()) {
-		Logger.println("Actor position ID out of range");
-		return false;
+		LOG_WARN(actorLog, "Actor position ID out of range");
+		return 0;
 	}
 	if (xSemaphoreTake(taskMutex, pdMS_TO_TICKS(2000)) == pdFAIL) {
-		Logger.println("Could not take action task mutex");
-		return false;
+		LOG_WARN(actorLog, "Could not take action task mutex");
+		return 0;
 	}
 	TaskHandle_t actionHandleCopy = actionHandle;
 	xSemaphoreGive(taskMutex);
 	if (actionHandleCopy == NULL) {
-		Logger.println("Action processor loop not running");
-		return false;
+		LOG_WARN(actorLog, "Action processor loop not running");
+		return 0;
+	}
+
+	// Get a ticket and reserve its slot in the completion table
+	if (xSemaphoreTake(resultMutex, pdMS_TO_TICKS(2000)) == pdFAIL) {
+		LOG_WARN(actorLog, "Could not take action result mutex");
+		return 0;
+	}
+	// Skip tickets whose slot still holds a pending action, only completed results can be overwritten
+	uint32_t ticket = 0;
+	for (size_t tries = 0; tries < resultCapacity && ticket == 0; tries++) {
+		actionResult& slot = results[nextTicket % resultCapacity];
+		if (slot.ticket == 0 || slot.complete) {
+			ticket = nextTicket;
+			slot.ticket = ticket;
+			slot.complete = false;
+			slot.response = { true, "" };
+		}
+		nextTicket++;
+		if (nextTicket == 0) {
+			// Ticket 0 indicates failure, so skip it on rollover
+			nextTicket = 1;
+		}
+	}
+	xSemaphoreGive(resultMutex);
+	if (ticket == 0) {
+		LOG_WARN(actorLog, "No free action result slot");
+		return 0;
 	}
 
 	actionCall new_action {
 		actorPosID,
 		actionID,
-		new String(payload)
+		new String(payload),
+		ticket,
+		delay > 0 ? getMillis() + delay : 0
 	};
 	// Add action to queue
 	if (xQueueSend(actionQueue, &new_action, 10 / portTICK_PERIOD_MS) != pdTRUE) {
-		Logger.println("Action queue full");
-		return false;
+		LOG_WARN(actorLog, "Action queue full");
+		delete new_action.payload;
+		storeResult(ticket, true, { true, R"({"success": false})" });
+		return 0;
 	}
 
-	return true;
+	return ticket;
+}
+
+/// @brief Retrieves the result of a queued action
+/// @param ticket The ticket returned when the action was queued
+/// @return A JSON string with the status of the action ("pending", "complete", or "unknown") and any response
+String ActorManager::getActionResult(uint32_t ticket) {
+	// Allocate the JSON document
+	JsonDocument doc;
+	doc["id"] = ticket;
+	doc["status"] = "unknown";
+	if (ticket != 0 && xSemaphoreTake(resultMutex, pdMS_TO_TICKS(2000)) == pdTRUE) {
+		actionResult& result = results[ticket % resultCapacity];
+		if (result.ticket == ticket) {
+			if (result.complete) {
+				doc["status"] = "complete";
+				doc["json"] = result.response.first;
+				if (result.response.first) {
+					doc["response"] = serialized(result.response.second);
+				} else {
+					doc["response"] = result.response.second;
+				}
+			} else {
+				doc["status"] = "pending";
+			}
+		}
+		xSemaphoreGive(resultMutex);
+	}
+	// Create string to hold output
+	String output;
+	// Serialize to string
+	serializeJson(doc, output);
+	return output;
 }
 
 /// @brief Retrieves the information on all available actors and their actions
@@ -202,7 +295,10 @@ String ActorManager::getActorConfig(String actorName) {
 /// @return True on success
 bool ActorManager::setActorConfig(int actorPosID, String config) {
 	if (actorPosID >= 0 && actorPosID < actors.size()) {
-		return actors[actorPosID]->setConfig(config, true);
+		bool success = actors[actorPosID]->setConfig(config, true);
+		// Even a rejected config may have been partly applied
+		ResponseCache::invalidate();
+		return success;
 	} else {
 		return false;
 	}
@@ -226,7 +322,7 @@ String ActorManager::getActorVersions() {
 	return output;
 }
 
-/// @brief Executes a actor on a receiver immediately. Use carefully, may cause issues with actors also being processed from queue
+/// @brief Executes a actor on a receiver immediately. Waits for any queued action running on the same actor to finish
 /// @param actor The position ID of the actor receiver
 /// @param action The name of the action
 /// @param payload An optional JSON string for data payload
@@ -247,7 +343,7 @@ std::pair<bool, String> ActorManager::processActionImmediately(String actor, Str
 	return processActionImmediately(actorPosID, action_id, payload);
 }
 
-/// @brief Executes a actor on a receiver immediately. Use carefully, may cause issues with actors also being processed from queue
+/// @brief Executes a actor on a receiver immediately. Waits for any queued action running on the same actor to finish
 /// @param actorPosID The position ID of the actor receiver
 /// @param action The name of the action
 /// @param payload An optional JSON string for data payload
@@ -255,7 +351,7 @@ std::pair<bool, String> ActorManager::processActionImmediately(String actor, Str
 std::pair<bool, String> ActorManager::processActionImmediately(int actorPosID, String action, String payload) {
 	// Check if actor exists
 	if(actorPosID < 0 || actorPosID >= actors.size()) {
-		Logger.println("Receiver position Id out of range");
+		LOG_WARN(actorLog, "Actor position ID out of range");
 		return { true, R"({"success": false})" };
 	}
 
@@ -269,7 +365,7 @@ std::pair<bool, String> ActorManager::processActionImmediately(int actorPosID, S
 	return processActionImmediately(actorPosID, action_id, payload);
 }
 
-/// @brief Executes a action on a actor immediately. Use carefully, may cause issues with actions also being processed from queue
+/// @brief Executes a action on a actor immediately. Waits for any queued action running on the same actor to finish
 /// @param actor The position ID of the actor receiver
 /// @param actionID The ID of the action
 /// @param payload An optional JSON string for data payload
@@ -285,7 +381,7 @@ std::pair<bool, String> ActorManager::processActionImmediately(String actor, int
 	return processActionImmediately(actorPosID, actionID, payload);
 }
 
-/// @brief Executes a action on a actor immediately. Use carefully, may cause issues with actions also being processed from queue
+/// @brief Executes a action on a actor immediately. Waits for any queued action running on the same actor to finish
 /// @param actorPosID The position ID of the actor receiver
 /// @param actionID The ID of the action
 /// @param payload An optional JSON string for data payload
@@ -293,11 +389,11 @@ std::pair<bool, String> ActorManager::processActionImmediately(String actor, int
 std::pair<bool, String> ActorManager::processActionImmediately(int actorPosID, int actionID, String payload) {
 	// Check if actor exists
 	if(actorPosID < 0 || actorPosID >= actors.size()) {
-		Logger.println("Receiver position ID out of range");
+		LOG_WARN(actorLog, "Actor position ID out of range");
 		return { true, R"({"success": false})" };
 	}
 	// Process action
-	return actors[actorPosID]->receiveAction(actionID, payload);
+	return runAction(actorPosID, actionID, payload, pdMS_TO_TICKS(immediateLockTimeout));
 }
 
 /// @brief Turns the name of an actor into its position ID
@@ -308,12 +404,12 @@ int ActorManager::actorNameToID(String name) {
 	try {
 		auto index = std::find_if(actors.begin(), actors.end(), [name](Actor* a) {return a->Description.name == name;});
 		if (index == actors.end()) {
-			Logger.println("Actor not found");
+			LOG_WARN(actorLog, "Actor %s not found", name.c_str());
 			return -1;
 		}
 		actorPosID = index - actors.begin();
 	} catch (const std::exception& e) {
-		Logger.println("Actor not found");
+		LOG_WARN(actorLog, "Actor %s not found", name.c_str());
 		return -1;
 	}
 	return actorPosID;
@@ -328,7 +424,7 @@ int ActorManager::actionNameToID(String name, int actorPosID) {
 	try {
 		action_id = actors[actorPosID]->Description.actions.at(name);
 	} catch (const std::out_of_range& e) {
-		Logger.printf("Receiver cannot process actor ID %d with action %s\n", actorPosID, name);
+		LOG_WARN(actorLog, "Actor ID %d cannot process action %s", actorPosID, name.c_str());
 		return -1;
 	}
 	return action_id;
@@ -338,7 +434,7 @@ int ActorManager::actionNameToID(String name, int actorPosID) {
 /// @param arg Not used
 void ActorManager::actionProcessor(void* arg) {
 	if (noActors) {
-		Logger.println("No actors, exiting action processor");
+		LOG_INFO(actorLog, "No actors, exiting action processor");
 		xSemaphoreTake(taskMutex, portMAX_DELAY);
 		actionHandle = nullptr;
 		xSemaphoreGive(taskMutex);
@@ -346,17 +442,99 @@ void ActorManager::actionProcessor(void* arg) {
 		return;
 	}
 	actionCall action;
-	while (xQueueReceive(actionQueue, &action, portMAX_DELAY) == pdTRUE) {
-		try { // Try/catch is not a great solution here, should be improved
-			actors[action.actorPosID]->receiveAction(action.actionID, *action.payload);
+	while (true) {
+		// Sleep until a new action arrives or the earliest timed action is due
+		TickType_t wait = portMAX_DELAY;
+		if (!timedActions.empty()) {
+			uint64_t now = getMillis();
+			uint64_t due = timedActions.top().dueTime;
+			wait = due > now ? pdMS_TO_TICKS(due - now) : 0;
 		}
-		catch (...) {
-			Logger.println("Exception in processing action payload from queue");
+		if (xQueueReceive(actionQueue, &action, wait) == pdTRUE) {
+			if (action.dueTime > getMillis()) {
+				// Hold action until it's due
+				if (timedActions.size() >= maxTimedActions) {
+					LOG_WARN(actorLog, "Timed action queue full, discarding action");
+					delete action.payload;
+					storeResult(action.ticket, true, { true, R"({"success": false})" });
+				} else {
+					timedActions.push(action);
+				}
+			} else {
+				processAction(action);
+			}
+		}
+		// Process all timed actions that are now due
+		while (!timedActions.empty() && timedActions.top().dueTime <= getMillis()) {
+			actionCall due_action = timedActions.top();
+			timedActions.pop();
+			processAction(due_action);
 		}
-		delete action.payload;
 	}
-	xSemaphoreTake(taskMutex, portMAX_DELAY);
-	actionHandle = nullptr;
-	xSemaphoreGive(taskMutex);
-	vTaskDelete(NULL);
+}
+
+/// @brief Processes an action from the queue and frees its payload
+/// @param action The action to process
+void ActorManager::processAction(actionCall action) {
+	std::pair<bool, String> response { true, R"({"success": false})" };
+	try { // Try/catch is not a great solution here, should be improved
+		response = runAction(action.actorPosID, action.actionID, *action.payload, portMAX_DELAY);
+	}
+	catch (...) {
+		LOG_ERROR(actorLog, "Exception in processing action payload from queue");
+	}
+	delete action.payload;
+	storeResult(action.ticket, true, response);
+	// Notify any receivers subscribed to action completions, the result can be retrieved with the ticket
+	EventBroadcaster::broadcastEvent(EventBroadcaster::Events::ActionComplete, action.actorPosID, action.actionID, (int32_t)action.ticket);
+}
+
+/// @brief Runs an action on an actor while holding that actor's lock, so actions on the same actor never overlap
+/// @param actorPosID The position ID of the actor
+/// @param actionID The ID of the action
+/// @param payload The JSON string data payload
+/// @param timeout The maximum time to wait for the actor to become free
+/// @return A pair with a string containing any response, and a bool indicating if it's JSON formatted
+std::pair<bool, String> ActorManager::runAction(int actorPosID, int actionID, const String& payload, TickType_t timeout) {
+	if (xSemaphoreTakeRecursive(actorLocks[actorPosID], timeout) == pdFALSE) {
+		LOG_WARN(actorLog, "Timed out waiting for %s to finish another action", actors[actorPosID]->Description.name.c_str());
+		return { true, R"({"success": false})" };
+	}
+	std::pair<bool, String> response;
+	try {
+		response = actors[actorPosID]->receiveAction(actionID, payload);
+	} catch (...) {
+		// Release the actor before passing the exception on
+		xSemaphoreGiveRecursive(actorLocks[actorPosID]);
+		throw;
+	}
+	xSemaphoreGiveRecursive(actorLocks[actorPosID]);
+	return response;
+}
+
+/// @brief Stores the result of a queued action in the slot reserved for its ticket
+/// @param ticket The ticket of the action
+/// @param complete True if the action has been processed
+/// @param response The response from the actor
+void ActorManager::storeResult(uint32_t ticket, bool complete, std::pair<bool, String> response) {
+	if (xSemaphoreTake(resultMutex, pdMS_TO_TICKS(2000)) == pdFALSE) {
+		LOG_WARN(actorLog, "Could not take action result mutex");
+		return;
+	}
+	actionResult& result = results[ticket % resultCapacity];
+	// Don't resurrect a result that was already overwritten by a newer action
+	if (complete && result.ticket != ticket) {
+		xSemaphoreGive(resultMutex);
+		return;
+	}
+	result.ticket = ticket;
+	result.complete = complete;
+	result.response = response;
+	xSemaphoreGive(resultMutex);
+}
+
+/// @brief Gets the time since boot without the 49 day rollover of millis()
+/// @return The number of ms since boot
+uint64_t ActorManager::getMillis() {
+	return esp_timer_get_time() / 1000;
 }
\ No newline at end of file
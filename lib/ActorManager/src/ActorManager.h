@@ -10,6 +10,9 @@
 #pragma once
 #include <ArduinoJson.h>
 #include <Actor.h>
+#include <EventBroadcaster.h>
+#include <ResponseCache.h>
+#include <esp_timer.h>
 #include <vector>
 #include <queue>
 
@@ -19,16 +22,69 @@ class ActorManager {
 		/// @brief Stores all the in-use actor actors
 		static std::vector<Actor*> actors;
 
+		/// @brief Per-actor mutexes so only one action runs on an actor at a time. Indexed by actor position ID
+		static std::vector<SemaphoreHandle_t> actorLocks;
+
+		/// @brief The maximum time, in ms, an immediate action will wait for an actor busy with another action
+		static const uint32_t immediateLockTimeout = 3000;
+
 		/// @brief Queue to hold action to be processed.
 		static QueueHandle_t actionQueue;
 
+		/// @brief The number of actions the queue can hold
+		static const size_t actionQueueLength = 15;
+
 		/// @brief Struct for grouping action and payloads
 		struct actionCall {
 			int actorPosID;
 			int actionID;
 			String* payload;
+			/// @brief The ticket used to look up the result of the action
+			uint32_t ticket;
+			/// @brief The time, in ms since boot, when the action is due. 0 to process as soon as possible
+			uint64_t dueTime;
+		};
+
+		/// @brief Orders timed actions so the action due soonest is at the top
+		struct dueLater {
+			bool operator()(const actionCall& a, const actionCall& b) const { return a.dueTime > b.dueTime; }
+		};
+
+		/// @brief Actions waiting for their due time, ordered by deadline. Only accessed by the action processor
+		static std::priority_queue<actionCall, std::vector<actionCall>, dueLater> timedActions;
+
+		/// @brief The maximum number of actions that can be waiting for their due time
+		static const size_t maxTimedActions = 32;
+
+		/// @brief Holds the result of a queued action
+		struct actionResult {
+			/// @brief The ticket of the action, 0 if the slot is unused
+			uint32_t ticket = 0;
+
+			/// @brief True once the action has been processed
+			bool complete = false;
+
+			/// @brief The response from the actor
+			std::pair<bool, String> response;
 		};
 
+		/// @brief The number of action results kept. Fits every action that can be pending (queued, timed, and the one being processed) with room left over for completed results, which are overwritten oldest first
+		static const size_t resultCapacity = 64;
+
+		/// @brief Completion table of recent action results, indexed by ticket modulo capacity
+		static actionResult results[resultCapacity];
+
+		/// @brief Mutex protecting access to the completion table and ticket counter
+		static SemaphoreHandle_t resultMutex;
+
+		/// @brief The ticket to give to the next queued action
+		static uint32_t nextTicket;
+
+		static uint64_t getMillis();
+		static void processAction(actionCall action);
+		static std::pair<bool, String> runAction(int actorPosID, int actionID, const String& payload, TickType_t timeout);
+		static void storeResult(uint32_t ticket, bool complete, std::pair<bool, String> response = { true, "" });
+
 	public:
 		/// @brief Task handle for action processor loop
 		static TaskHandle_t actionHandle;
@@ -41,14 +97,15 @@ class ActorManager {
 		
 		static bool addActor(Actor* actor);
 		static bool beginActors();
-		static bool addActionToQueue(String actor, String action, String payload = "");
-		static bool addActionToQueue(int actorPosID, String action, String payload = "");
-		static bool addActionToQueue(String actor, int actionID, String payload = "");
-		static bool addActionToQueue(int actorPosID, int actionID, String payload = "");
+		static uint32_t addActionToQueue(String actor, String action, String payload = "", ulong delay = 0);
+		static uint32_t addActionToQueue(int actorPosID, String action, String payload = "", ulong delay = 0);
+		static uint32_t addActionToQueue(String actor, int actionID, String payload = "", ulong delay = 0);
+		static uint32_t addActionToQueue(int actorPosID, int actionID, String payload = "", ulong delay = 0);
 		static std::pair<bool, String> processActionImmediately(String actor, String action, String payload = "");
 		static std::pair<bool, String> processActionImmediately(int actorPosID, String action, String payload = "");
 		static std::pair<bool, String> processActionImmediately(String actor, int actionID, String payload = "");
 		static std::pair<bool, String> processActionImmediately(int actorPosID, int actionID, String payload = "");
+		static String getActionResult(uint32_t ticket);
 		static String getActorInfo();
 		static std::vector<Actor*> getActors();
 		static String getActorConfig(int actorPosID);
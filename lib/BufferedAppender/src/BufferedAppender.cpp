@@ -0,0 +1,199 @@
+#include "BufferedAppender.h"
+
+// Initialize static variables
+std::vector<BufferedAppender*> BufferedAppender::appenders;
+SemaphoreHandle_t BufferedAppender::appendersMutex = xSemaphoreCreateMutex();
+
+/// @brief Creates a buffered appender
+/// @param Path The path of the file to append to
+/// @param BufferSize The size of the write buffer in bytes, ideally a multiple of the flash sector size
+/// @param FlushInterval Longest time in ms data waits in the buffer before it's written
+BufferedAppender::BufferedAppender(String Path, size_t BufferSize, uint32_t FlushInterval) {
+	path = Path;
+	bufferSize = BufferSize;
+	flushInterval = FlushInterval;
+	mutex = xSemaphoreCreateMutex();
+	if (xSemaphoreTake(appendersMutex, portMAX_DELAY) == pdTRUE) {
+		appenders.push_back(this);
+		xSemaphoreGive(appendersMutex);
+	}
+}
+
+/// @brief Flushes and closes the file
+BufferedAppender::~BufferedAppender() {
+	if (xSemaphoreTake(appendersMutex, portMAX_DELAY) == pdTRUE) {
+		appenders.erase(std::remove(appenders.begin(), appenders.end(), this), appenders.end());
+		xSemaphoreGive(appendersMutex);
+	}
+	close();
+	free(buffer);
+	vSemaphoreDelete(mutex);
+}
+
+/// @brief Adds a record to the buffer, writing full sectors to the file when the buffer fills
+/// @param data The record
+/// @param size The size of the record in bytes
+/// @return True on success
+bool BufferedAppender::append(const uint8_t* data, size_t size) {
+	if (xSemaphoreTake(mutex, pdMS_TO_TICKS(1000)) == pdFALSE) {
+		return false;
+	}
+	if (!open()) {
+		xSemaphoreGive(mutex);
+		return false;
+	}
+	bool success = true;
+	if (used == 0) {
+		oldestAt = millis();
+	}
+	while (success && size > 0) {
+		size_t count = std::min(size, bufferSize - used);
+		memcpy(buffer + used, data, count);
+		used += count;
+		data += count;
+		size -= count;
+		if (used == bufferSize) {
+			success = writeBuffer(false);
+		}
+	}
+	xSemaphoreGive(mutex);
+	return success;
+}
+
+/// @brief Adds a record to the buffer
+/// @param record The record
+/// @return True on success
+bool BufferedAppender::append(const String& record) {
+	return append(reinterpret_cast<const uint8_t*>(record.c_str()), record.length());
+}
+
+/// @brief Adds a character to the buffer, allowing the appender to be printed to
+/// @param c The character
+/// @return The number of bytes added
+size_t BufferedAppender::write(uint8_t c) {
+	return append(&c, 1) ? 1 : 0;
+}
+
+/// @brief Adds data to the buffer, allowing the appender to be printed to
+/// @param buffer The data
+/// @param size The size of the data in bytes
+/// @return The number of bytes added
+size_t BufferedAppender::write(const uint8_t* buffer, size_t size) {
+	return append(buffer, size) ? size : 0;
+}
+
+/// @brief Writes everything in the buffer to the file and commits it to the media
+void BufferedAppender::flush() {
+	flushBuffer(true);
+}
+
+/// @brief Writes everything in the buffer to the file
+/// @param sync True to also commit the file to the media, so the data survives a reset
+/// @return True on success
+bool BufferedAppender::flushBuffer(bool sync) {
+	if (xSemaphoreTake(mutex, pdMS_TO_TICKS(1000)) == pdFALSE) {
+		return false;
+	}
+	bool success = used == 0 || writeBuffer(true);
+	if (success && sync && file) {
+		file.flush();
+	}
+	xSemaphoreGive(mutex);
+	return success;
+}
+
+/// @brief Flushes and closes the file. It's reopened by the next append
+void BufferedAppender::close() {
+	if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+		if (used > 0) {
+			writeBuffer(true);
+		}
+		if (file) {
+			file.close();
+		}
+		xSemaphoreGive(mutex);
+	}
+}
+
+/// @brief Gets the path of the file being appended to
+/// @return The path
+String BufferedAppender::getPath() {
+	return path;
+}
+
+/// @brief Flushes every appender holding data older than its flush interval. Call regularly, e.g. from the main loop
+void BufferedAppender::flushStale() {
+	if (xSemaphoreTake(appendersMutex, pdMS_TO_TICKS(100)) == pdFALSE) {
+		return;
+	}
+	ulong now = millis();
+	for (const auto& a : appenders) {
+		if (a->used > 0 && now - a->oldestAt >= a->flushInterval) {
+			a->flushBuffer();
+		}
+	}
+	xSemaphoreGive(appendersMutex);
+}
+
+/// @brief Flushes every appender, e.g. before a reboot
+void BufferedAppender::flushAll() {
+	if (xSemaphoreTake(appendersMutex, pdMS_TO_TICKS(1000)) == pdFALSE) {
+		return;
+	}
+	for (const auto& a : appenders) {
+		a->flush();
+	}
+	xSemaphoreGive(appendersMutex);
+}
+
+/// @brief Opens the file and allocates the buffer if needed. Must hold the mutex
+/// @return True on success
+bool BufferedAppender::open() {
+	if (buffer == nullptr) {
+		buffer = static_cast<uint8_t*>(malloc(bufferSize));
+		if (buffer == nullptr) {
+			Logger.println("Could not allocate append buffer for " + path);
+			return false;
+		}
+	}
+	if (!file) {
+		file = Storage::openFile(path, FILE_APPEND);
+		if (!file) {
+			return false;
+		}
+		fileSize = file.size();
+	}
+	return true;
+}
+
+/// @brief Writes the buffer to the file. Must hold the mutex
+/// @param all True to write everything, false to write up to the last sector boundary and keep the rest buffered
+/// @return True on success
+bool BufferedAppender::writeBuffer(bool all) {
+	if (!file) {
+		return false;
+	}
+	size_t count = used;
+	if (!all) {
+		// Leave the part past the last sector boundary for the next write
+		size_t spill = (fileSize + used) % sectorSize;
+		if (spill < used) {
+			count -= spill;
+		}
+	}
+	if (count >= Storage::freeSpace(path)) {
+		Logger.println("Not enough free space to append to " + path);
+		used = 0;
+		return false;
+	}
+	size_t written = file.write(buffer, count);
+	fileSize += written;
+	// Writes through the open file bypass Storage, so count them against the free space
+	Storage::consumeSpace(path, written);
+	memmove(buffer, buffer + count, used - count);
+	used -= count;
+	if (used > 0) {
+		oldestAt = millis();
+	}
+	return written == count;
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+/*
+* This file and associated .cpp file are licensed under the GPLv3 License Copyright (c) 2024 Sam Groveman
+* Contributors: Sam Groveman
+*/
+
+#pragma once
+#include <Arduino.h>
+#include <Storage.h>
+#include <algorithm>
+#include <vector>
+
+/// @brief Appends records to a file through a write-behind buffer, keeping the file open and writing in whole sectors
+class BufferedAppender : public Print {
+	public:
+		BufferedAppender(String Path, size_t BufferSize = 4096, uint32_t FlushInterval = 5000);
+		~BufferedAppender();
+		bool append(const uint8_t* data, size_t size);
+		bool append(const String& record);
+		size_t write(uint8_t c) override;
+		size_t write(const uint8_t* buffer, size_t size) override;
+		void flush() override;
+		bool flushBuffer(bool sync = true);
+		void close();
+		String getPath();
+		static void flushStale();
+		static void flushAll();
+
+	private:
+		/// @brief Size of a flash sector, writes triggered by a full buffer end on a sector boundary
+		static const size_t sectorSize = 512;
+
+		/// @brief Every open appender, used to flush stale buffers
+		static std::vector<BufferedAppender*> appenders;
+
+		/// @brief Mutex protecting the collection of appenders
+		static SemaphoreHandle_t appendersMutex;
+
+		/// @brief The path of the file being appended to
+		String path;
+
+		/// @brief The open file, kept open between flushes
+		File file;
+
+		/// @brief Buffer holding records not yet written
+		uint8_t* buffer = nullptr;
+
+		/// @brief The size of the buffer in bytes
+		size_t bufferSize;
+
+		/// @brief Number of bytes in the buffer
+		size_t used = 0;
+
+		/// @brief The size of the file on the media
+		size_t fileSize = 0;
+
+		/// @brief Longest time in ms data waits in the buffer before it's written
+		uint32_t flushInterval;
+
+		/// @brief Time in ms data was first added to an empty buffer
+		ulong oldestAt = 0;
+
+		/// @brief Mutex protecting the buffer and file
+		SemaphoreHandle_t mutex;
+
+		bool open();
+		bool writeBuffer(bool all);
+};
\ No newline at end of file
@@ -22,12 +22,21 @@ bool Configuration::begin(String File) {
 /// @brief Deserializes JSON from config file and applies it to current config
 /// @return True on success
 bool Configuration::loadConfig() {
+	// Finish or roll back a save interrupted by a reset
+	Storage::recoverFile(file);
 	String json_string = Storage::readFile(file);
 	if (json_string == "") {
 		Logger.println("Could not load config file, or it doesn't exist. Defaults used.");
 		json_string = configToJSON();
 	}
-	return updateConfig(json_string);
+	if (updateConfig(json_string)) {
+		return true;
+	}
+	if (Storage::restoreBackup(file)) {
+		Logger.println("Config file corrupt, using backup");
+		return updateConfig(Storage::readFile(file));
+	}
+	return false;
 }
 
 /// @brief Updates the current config to match a JSON string of settings
@@ -74,6 +83,7 @@ bool Configuration::updateConfig(String config) {
 	} 
 	// Set both GMT offset and DST offset
 	TimeInterface::setOffset(currentConfig.gmtOffset_sec, currentConfig.daylightOffset_sec);
+	ResponseCache::invalidate();
 	return true;
 }
 
@@ -87,7 +97,7 @@ bool Configuration::saveConfig() {
 /// @param config A complete and properly formatted JSON string of all the settings
 /// @return True on success
 bool Configuration::saveConfig(String config) {
-	if(!Storage::writeFile(file, config)) {
+	if(!Storage::writeFileAtomic(file, config)) {
 		Logger.println("Could not write config file");
 		return false;
 	}
@@ -12,6 +12,7 @@
 #include <Storage.h>
 #include <LogBroadcaster.h>
 #include <TimeInterface.h>
+#include <ResponseCache.h>
 
 /// @brief Holds and manages the hub configuration
 class Configuration {
@@ -14,19 +14,56 @@ bool DeviceConfig::setConfig(String config, bool save) {
 	return true;
 }
 
-/// @brief Saves the current config to a JSON file
+/// @brief Saves the current config to a JSON file. When the storage task is running the save is queued ahead of other storage work, so device tasks and web requests never wait on the media, and this returns once it's queued. Failures are then logged
 /// @return True on success
 /// @param path The path to the config file to save
 /// @param contents The contents to save in the file
 bool DeviceConfig::saveConfig(String path, String contents) {
-	return Storage::writeFile(path, contents);
+	if (StorageWorker::isRunning()) {
+		return StorageWorker::writeFileAtomic(path, contents, [path](bool success, const String& result) {
+			if (!success) {
+				Logger.println("Could not save config " + path);
+			}
+		}, StorageWorker::Priority::High);
+	}
+	return Storage::writeFileAtomic(path, contents);
+}
+
+/// @brief Saves a JSON document to a config file. Serializes straight to the file when saving on the caller's task, or to a string to be queued on the storage task
+/// @param path The path to the config file to save
+/// @param contents The JSON document to save in the file
+/// @return True on success
+bool DeviceConfig::saveConfig(String path, const JsonDocument& contents) {
+	if (StorageWorker::isRunning()) {
+		String serialized;
+		serializeJson(contents, serialized);
+		return saveConfig(path, serialized);
+	}
+	return Storage::writeFileAtomic(path, measureJson(contents), [&contents](Print& file) {
+		return serializeJson(contents, file) > 0;
+	});
+}
+
+/// @brief Loads a config file saved with saveConfig, falling back to the backup if the file can't be parsed. Waits for a queued save of the file to finish first
+/// @param path The path to the config file
+/// @return The contents of the config file, or an empty string if there's no usable config
+String DeviceConfig::loadConfig(String path) {
+	if (!Storage::recoverFile(path)) {
+		return "";
+	}
+	String contents = Storage::readFile(path);
+	JsonDocument doc;
+	if (deserializeJson(doc, contents) && Storage::restoreBackup(path)) {
+		contents = Storage::readFile(path);
+	}
+	return contents;
 }
 
 /// @brief Checks for the existence of the config file. Creates necessary containing directories as needed during check
 /// @param path The path to the config file
 /// @return True if config file exists
 bool DeviceConfig::checkConfig(String path) {
-	if (!Storage::fileExists(path)) {
+	if (!Storage::recoverFile(path)) {
 		// Check for, and create, directories
 		size_t pos = 0;
 		String path_builder = "";
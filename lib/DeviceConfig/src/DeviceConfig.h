@@ -6,7 +6,9 @@
 
 #pragma once
 #include <Arduino.h>
+#include <ArduinoJson.h>
 #include <Storage.h>
+#include <StorageWorker.h>
 
 /// @brief Used by device classes to inherit saving a local configuration
 class DeviceConfig {
@@ -15,5 +17,7 @@ class DeviceConfig {
 		virtual bool setConfig(String config, bool save);
 	protected:
 		bool saveConfig(String path, String contents);
+		bool saveConfig(String path, const JsonDocument& contents);
+		String loadConfig(String path);
 		bool checkConfig(String path);
 };
\ No newline at end of file
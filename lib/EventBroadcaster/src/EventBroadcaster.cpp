@@ -2,7 +2,13 @@
 
 // Initialize static variables
 std::vector<EventReceiver*> EventBroadcaster::receivers;
-QueueHandle_t EventBroadcaster::eventQueue = xQueueCreate(15, sizeof(int));
+std::vector<EventReceiver*> EventBroadcaster::subscribers[EventBroadcaster::topicCount];
+EventReceiver::EventData EventBroadcaster::eventRing[EventBroadcaster::eventCapacity];
+size_t EventBroadcaster::ringHead = 0;
+size_t EventBroadcaster::ringCount = 0;
+portMUX_TYPE EventBroadcaster::ringLock = portMUX_INITIALIZER_UNLOCKED;
+volatile uint32_t EventBroadcaster::droppedEvents = 0;
+volatile uint32_t EventBroadcaster::coalescedEvents = 0;
 TaskHandle_t EventBroadcaster::eventHandle = nullptr;
 SemaphoreHandle_t EventBroadcaster::taskMutex = xSemaphoreCreateMutex();
 bool EventBroadcaster::noReceivers = true;
@@ -18,14 +24,6 @@ bool EventBroadcaster::beginReceivers() {
 		}
 	}
 
-	// Ensure event queue was created
-	if (eventQueue == NULL) {
-		eventQueue = xQueueCreate(10, sizeof(int));
-		if (eventQueue == NULL) {
-			return false;
-		}
-	}
-
 	if (!receivers.empty()) {
 		noReceivers = false;
 		for (const auto& r : EventBroadcaster::receivers) {
@@ -34,33 +32,73 @@ bool EventBroadcaster::beginReceivers() {
 			}
 		}
 	}
+	// Resolve subscriptions now so dispatch only visits interested receivers
+	for (int i = 0; i < topicCount; i++) {
+		subscribers[i].clear();
+		for (const auto& r : receivers) {
+			if (r->eventFilter & (1UL << i)) {
+				subscribers[i].push_back(r);
+			}
+		}
+	}
 	return true;
 }
 
-/// @brief Broadcasts an event to all subscribed receivers
+/// @brief Broadcasts an event to all subscribed receivers. Never blocks, if the ring is full the oldest event is dropped
 /// @param event The event to broadcast
+/// @param subject The subject of the event, e.g. the position ID of a sensor or actor. -1 if none
+/// @param value Any value accompanying the event
+/// @param code Any code accompanying the event
 /// @return True on success
-bool EventBroadcaster::broadcastEvent(Events event) {
-	if (noReceivers) {
+bool EventBroadcaster::broadcastEvent(Events event, int subject, double value, int32_t code) {
+	if (noReceivers || (int)event >= topicCount || subscribers[event].empty()) {
 		// Discard event (this returns true because it's not an error)
 		return true;
 	}
-	if (xSemaphoreTake(taskMutex, pdMS_TO_TICKS(500)) == pdFALSE) {
-		return false;
+	EventReceiver::EventData data { (int)event, subject, value, code };
+	portENTER_CRITICAL(&ringLock);
+	if (ringCount > 0) {
+		EventReceiver::EventData& newest = eventRing[(ringHead + eventCapacity - 1) % eventCapacity];
+		if (newest.event == data.event && newest.subject == data.subject && newest.code == data.code) {
+			// Same as the most recent event still waiting, just update its value
+			newest.value = data.value;
+			coalescedEvents++;
+			portEXIT_CRITICAL(&ringLock);
+			return true;
+		}
 	}
+	if (ringCount == eventCapacity) {
+		// Ring is full, the write below overwrites the oldest event
+		ringCount--;
+		droppedEvents++;
+	}
+	eventRing[ringHead] = data;
+	ringHead = (ringHead + 1) % eventCapacity;
+	ringCount++;
+	portEXIT_CRITICAL(&ringLock);
+
+	// Reading the handle is atomic, so the task mutex isn't needed just to wake the processor
 	TaskHandle_t eventTaskCopy = eventHandle;
-	xSemaphoreGive(taskMutex);
-		
 	if(eventTaskCopy == NULL) {
 		// Event processor loop not running when it should be
 		return false;
 	}
-	int event_value = (int)event;
-	// Add event to queue
-	if (xQueueSend(eventQueue, &event_value, pdMS_TO_TICKS(10000)) != pdTRUE) {
-		Logger.println("Failed to queue event");
+	xTaskNotifyGive(eventTaskCopy);
+	return true;
+}
+
+/// @brief Removes the oldest event from the ring
+/// @param data Set to the event removed
+/// @return True if an event was available
+bool EventBroadcaster::takeEvent(EventReceiver::EventData& data) {
+	portENTER_CRITICAL(&ringLock);
+	if (ringCount == 0) {
+		portEXIT_CRITICAL(&ringLock);
 		return false;
 	}
+	data = eventRing[(ringHead + eventCapacity - ringCount) % eventCapacity];
+	ringCount--;
+	portEXIT_CRITICAL(&ringLock);
 	return true;
 }
 
@@ -100,23 +138,26 @@ void EventBroadcaster::eventProcessor(void* arg) {
 		vTaskDelete(NULL);
 		return;
 	}
-	int event;
-	// Process all events in the queue
-	while (xQueueReceive(eventQueue, &event, portMAX_DELAY) == pdTRUE)
-	{
-		try { // Try/catch is not a great solution here, should be improved
-			for (const auto& r : EventBroadcaster::receivers) {
-				if (!r->receiveEvent(event)) {
-					Logger.printf("Error with event receiver %s", r->Description.name);
+	EventReceiver::EventData data;
+	while (true) {
+		// Wait to be woken by a new event
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		// Process all events in the ring
+		while (takeEvent(data)) {
+			try { // Try/catch is not a great solution here, should be improved
+				// Only visit receivers subscribed to this event
+				for (const auto& r : subscribers[data.event]) {
+					if (r->subjectFilter != -1 && r->subjectFilter != data.subject) {
+						continue;
+					}
+					if (!r->receiveEvent(data)) {
+						Logger.printf("Error with event receiver %s\n", r->Description.name.c_str());
+					}
 				}
 			}
+			catch (...) {
+				Logger.println("Exception in processing event from queue");
+			}
 		}
-		catch (...) {
-			Logger.println("Exception in processing event from queue");
-		}
-	} 
-	xSemaphoreTake(taskMutex, portMAX_DELAY);
-	eventHandle = nullptr;
-	xSemaphoreGive(taskMutex);
-	vTaskDelete(NULL);
+	}
 }
\ No newline at end of file
@@ -19,12 +19,32 @@ class EventBroadcaster {
 		/// @brief Stores all event receivers
 		static std::vector<EventReceiver*> receivers;
 
-		/// @brief Queue to hold events to be processed
-		static QueueHandle_t eventQueue;
+		/// @brief The number of events the ring can hold before the oldest are dropped
+		static const size_t eventCapacity = 32;
+
+		/// @brief The number of event values that can be subscribed to
+		static const int topicCount = 32;
+
+		/// @brief Receivers subscribed to each event value, resolved from their filters when receivers are started
+		static std::vector<EventReceiver*> subscribers[topicCount];
+
+		/// @brief Ring buffer holding events waiting to be processed
+		static EventReceiver::EventData eventRing[eventCapacity];
+
+		/// @brief Position in the ring the next event is written to
+		static size_t ringHead;
+
+		/// @brief Number of events currently in the ring
+		static size_t ringCount;
+
+		/// @brief Spinlock protecting the ring, only ever held for a few instructions
+		static portMUX_TYPE ringLock;
+
+		static bool takeEvent(EventReceiver::EventData& data);
 
 	public:
-		/// @brief Stores possible events to raise
-		enum Events { Clear, Running, Ready, Starting, WifiConfig, Updating, Rebooting, Error };
+		/// @brief Stores possible events to raise. Values up to Error are status events, later values are data events that carry a subject and value
+		enum Events { Clear, Running, Ready, Starting, WifiConfig, Updating, Rebooting, Error, Measurement, ActionComplete };
 
 		/// @brief True if no receiver devices
 		static bool noReceivers;
@@ -35,9 +55,15 @@ class EventBroadcaster {
 		/// @brief Mutex for protecting access to task handle
 		static SemaphoreHandle_t taskMutex;
 
+		/// @brief Number of events dropped because the ring was full
+		static volatile uint32_t droppedEvents;
+
+		/// @brief Number of events merged into an identical event already waiting in the ring
+		static volatile uint32_t coalescedEvents;
+
 		static bool beginReceivers();
-		static bool broadcastEvent(Events event);
+		static bool broadcastEvent(Events event, int subject = -1, double value = 0, int32_t code = 0);
 		static bool addReceiver(EventReceiver* receiver);
 		static String getReceiverVersions();
 		static void eventProcessor(void* arg);
-};
+};
\ No newline at end of file
@@ -4,4 +4,18 @@
 /// @return True on success
 bool EventReceiver::begin() {
 	return true;
+}
+
+/// @brief Receives an event without any accompanying data
+/// @param event The event value
+/// @return True on success
+bool EventReceiver::receiveEvent(int event) {
+	return true;
+}
+
+/// @brief Receives an event with its accompanying data. By default passes only the event value on to receiveEvent(int)
+/// @param data The event and its data
+/// @return True on success
+bool EventReceiver::receiveEvent(const EventData& data) {
+	return receiveEvent(data.event);
 }
\ No newline at end of file
@@ -10,6 +10,21 @@
 /// @brief Receives device events
 class EventReceiver {
 	public:
+		/// @brief Describes an event and any data accompanying it
+		struct EventData {
+			/// @brief The event value (see EventBroadcaster::Events)
+			int event;
+
+			/// @brief The subject of the event, e.g. the position ID of a sensor or actor. -1 if none
+			int subject;
+
+			/// @brief Any value accompanying the event, e.g. a measured value
+			double value;
+
+			/// @brief Any code accompanying the event, e.g. a parameter index, action ticket, or error code
+			int32_t code;
+		};
+
 		/// @brief Contains a description of this receiver
 		struct {
 			/// @brief The name of the receiver
@@ -19,6 +34,13 @@ class EventReceiver {
 			String version = "0.01";
 		} Description;
 
+		/// @brief Bitmask of the events this receiver subscribes to, bit n corresponds to event value n. Defaults to the status events, data events such as measurements must be opted into. Set before events are started
+		uint32_t eventFilter = 0xFF;
+
+		/// @brief Only receive events with this subject, -1 for any subject. Set before events are started
+		int subjectFilter = -1;
+
 		virtual bool begin();
-		virtual bool receiveEvent(int event) = 0;
+		virtual bool receiveEvent(int event);
+		virtual bool receiveEvent(const EventData& data);
 };
\ No newline at end of file
@@ -0,0 +1,297 @@
+#include "FirmwareUpdater.h"
+
+// Initialize static variables
+uint8_t* FirmwareUpdater::buffers[2] = { nullptr, nullptr };
+uint8_t FirmwareUpdater::active = 0;
+size_t FirmwareUpdater::fill = 0;
+QueueHandle_t FirmwareUpdater::chunkQueue = NULL;
+SemaphoreHandle_t FirmwareUpdater::bufferFree = NULL;
+TaskHandle_t FirmwareUpdater::writerHandle = NULL;
+const esp_partition_t* FirmwareUpdater::partition = nullptr;
+mbedtls_sha256_context FirmwareUpdater::sha;
+String FirmwareUpdater::expectedHash;
+String FirmwareUpdater::error;
+size_t FirmwareUpdater::imageSize = 0;
+size_t FirmwareUpdater::received = 0;
+size_t FirmwareUpdater::skip = 0;
+volatile size_t FirmwareUpdater::written = 0;
+volatile size_t FirmwareUpdater::erased = 0;
+volatile FirmwareUpdater::State FirmwareUpdater::state = FirmwareUpdater::State::Idle;
+
+// Update progress is logged at info level
+static LogModule updateLog("FirmwareUpdater");
+
+/// @brief Starts an upload of firmware, either a new update or the rest of one that was interrupted
+/// @param offset Position in the image the upload starts at, 0 for a new update
+/// @param size Size of the image in bytes if known, lets the whole space be erased up front in the background
+/// @param sha256 Expected SHA-256 of the image as hex, checked before the image is made bootable
+/// @return True if the upload can go ahead, false if it doesn't continue the interrupted update or the update couldn't start
+bool FirmwareUpdater::begin(size_t offset, size_t size, String sha256) {
+	sha256.toLowerCase();
+	if (offset > 0) {
+		// Resume, the data up to the offset must already be here
+		if (state != State::Receiving || offset > received || (sha256 != "" && sha256 != expectedHash)) {
+			LOG_WARN(updateLog, "Can't resume update at %u, %u bytes received", offset, received);
+			return false;
+		}
+		skip = received - offset;
+		LOG_INFO(updateLog, "Resuming update at %u", received);
+		return true;
+	}
+	if (writerHandle != NULL) {
+		abort("Restarted");
+	}
+	partition = esp_ota_get_next_update_partition(NULL);
+	if (partition == nullptr || size > partition->size) {
+		error = partition == nullptr ? "No update partition" : "Image too large";
+		state = State::Failed;
+		return false;
+	}
+	buffers[0] = static_cast<uint8_t*>(malloc(bufferSize));
+	buffers[1] = static_cast<uint8_t*>(malloc(bufferSize));
+	chunkQueue = xQueueCreate(2, sizeof(Chunk));
+	// Counts the buffer not being filled as free
+	bufferFree = xSemaphoreCreateCounting(1, 1);
+	if (buffers[0] == nullptr || buffers[1] == nullptr || chunkQueue == NULL || bufferFree == NULL) {
+		release();
+		error = "Out of memory";
+		state = State::Failed;
+		return false;
+	}
+	mbedtls_sha256_init(&sha);
+	mbedtls_sha256_starts(&sha, 0);
+	expectedHash = sha256;
+	error = "";
+	imageSize = size;
+	received = 0;
+	skip = 0;
+	written = 0;
+	erased = 0;
+	active = 0;
+	fill = 0;
+	state = State::Receiving;
+	if (xTaskCreate(writer, "OTA Writer", 4096, NULL, 1, &writerHandle) != pdPASS) {
+		release();
+		error = "Could not start writer";
+		state = State::Failed;
+		return false;
+	}
+	LOG_INFO(updateLog, "Update started, writing to %s", partition->label);
+	return true;
+}
+
+/// @brief Adds received data to the image
+/// @param data The data
+/// @param len The length of the data in bytes
+/// @return True on success
+bool FirmwareUpdater::write(const uint8_t* data, size_t len) {
+	if (state != State::Receiving) {
+		stopWriter();
+		return false;
+	}
+	// Skip data repeated by a resumed upload
+	size_t skipped = std::min(skip, len);
+	skip -= skipped;
+	data += skipped;
+	len -= skipped;
+	if (imageSize > 0 && received + len > imageSize) {
+		abort("More data than the image size");
+		return false;
+	}
+	while (len > 0) {
+		size_t count = std::min(len, bufferSize - fill);
+		memcpy(buffers[active] + fill, data, count);
+		fill += count;
+		received += count;
+		data += count;
+		len -= count;
+		if (fill == bufferSize && !submit(fill)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/// @brief Ends an upload. If the image size is known and more is to come, the update waits for an upload resuming from where this one ended
+/// @return True if the image was verified and will boot on restart, or the update is waiting for the rest of the image
+bool FirmwareUpdater::finish() {
+	if (state != State::Receiving) {
+		stopWriter();
+		return false;
+	}
+	if (imageSize > 0 && received < imageSize) {
+		LOG_INFO(updateLog, "Update paused at %u bytes", received);
+		return true;
+	}
+	state = State::Verifying;
+	Chunk last { active, fill };
+	Chunk end { 0, 0 };
+	if ((fill > 0 && xQueueSend(chunkQueue, &last, pdMS_TO_TICKS(writerTimeout)) != pdTRUE) || xQueueSend(chunkQueue, &end, pdMS_TO_TICKS(writerTimeout)) != pdTRUE) {
+		abort("Writer stalled");
+		return false;
+	}
+	// The writer verifies the image and releases everything
+	for (uint32_t waited = 0; state == State::Verifying && waited < writerTimeout; waited += 10) {
+		delay(10);
+	}
+	return state == State::Done;
+}
+
+/// @brief Abandons the update in progress, the running firmware stays in use
+/// @param reason Why the update was abandoned
+void FirmwareUpdater::abort(String reason) {
+	LOG_ERROR(updateLog, "Update failed: %s", reason.c_str());
+	error = reason;
+	bool running = writerHandle != NULL;
+	state = State::Failed;
+	if (running) {
+		// The writer drops any data left and stops at the end marker
+		Chunk end { 0, 0 };
+		xQueueSend(chunkQueue, &end, pdMS_TO_TICKS(writerTimeout));
+		for (uint32_t waited = 0; writerHandle != NULL && waited < writerTimeout; waited += 10) {
+			delay(10);
+		}
+	}
+}
+
+/// @brief Stops the writer task if a flash error left it running
+void FirmwareUpdater::stopWriter() {
+	if (state == State::Failed && writerHandle != NULL) {
+		abort(error);
+	}
+}
+
+/// @brief Gets the progress of the update
+/// @return The state
+FirmwareUpdater::State FirmwareUpdater::getState() {
+	return state;
+}
+
+/// @brief Gets how much of the image has been received, where an interrupted upload should resume from
+/// @return The number of bytes
+size_t FirmwareUpdater::getReceived() {
+	return state == State::Receiving ? received : 0;
+}
+
+/// @brief Gets why the last update failed
+/// @return The reason, empty if it didn't fail
+String FirmwareUpdater::getError() {
+	return error;
+}
+
+/// @brief Gets the progress of the update
+/// @return A JSON string of the state, bytes received, written and erased, the image size, and any error
+String FirmwareUpdater::getStatus() {
+	static const char* states[] = { "idle", "receiving", "verifying", "done", "failed" };
+	String status = "{\"state\":\"" + String(states[static_cast<int>(state)]) + "\"";
+	status += ",\"received\":" + String(received);
+	status += ",\"written\":" + String(written);
+	status += ",\"erased\":" + String(erased);
+	status += ",\"size\":" + String(imageSize);
+	status += ",\"error\":\"" + error + "\"}";
+	return status;
+}
+
+/// @brief Hands the buffer being filled to the writer task and waits for the other to be free
+/// @param length Bytes of data in the buffer
+/// @return True on success
+bool FirmwareUpdater::submit(size_t length) {
+	Chunk chunk { active, length };
+	if (xQueueSend(chunkQueue, &chunk, pdMS_TO_TICKS(writerTimeout)) != pdTRUE || xSemaphoreTake(bufferFree, pdMS_TO_TICKS(writerTimeout)) != pdTRUE) {
+		abort("Writer stalled");
+		return false;
+	}
+	active ^= 1;
+	fill = 0;
+	return true;
+}
+
+/// @brief Erases the partition up to a position, a block at a time
+/// @param end The position in bytes
+/// @return True on success
+bool FirmwareUpdater::eraseTo(size_t end) {
+	end = std::min<size_t>((end + eraseSize - 1) / eraseSize * eraseSize, partition->size);
+	while (erased < end) {
+		size_t length = std::min<size_t>(eraseSize, partition->size - erased);
+		if (esp_partition_erase_range(partition, erased, length) != ESP_OK) {
+			return false;
+		}
+		erased += length;
+	}
+	return true;
+}
+
+/// @brief Frees the buffers, queue and semaphore
+void FirmwareUpdater::release() {
+	free(buffers[0]);
+	free(buffers[1]);
+	buffers[0] = nullptr;
+	buffers[1] = nullptr;
+	if (chunkQueue != NULL) {
+		vQueueDelete(chunkQueue);
+		chunkQueue = NULL;
+	}
+	if (bufferFree != NULL) {
+		vSemaphoreDelete(bufferFree);
+		bufferFree = NULL;
+	}
+}
+
+/// @brief Writes and hashes filled buffers, erasing ahead while waiting for data, then verifies the image and makes it bootable
+/// @param arg Not used
+void FirmwareUpdater::writer(void* arg) {
+	Chunk chunk;
+	while (true) {
+		// Erase ahead while there's nothing to write: the whole image if its size is known, otherwise a few blocks
+		size_t eraseTarget = imageSize > 0 ? imageSize : written + eraseAhead;
+		if (xQueueReceive(chunkQueue, &chunk, state == State::Receiving && erased < std::min<size_t>(eraseTarget, partition->size) ? 0 : portMAX_DELAY) != pdTRUE) {
+			if (!eraseTo(erased + eraseSize)) {
+				error = "Flash erase failed";
+				state = State::Failed;
+			}
+			continue;
+		}
+		if (chunk.length == 0) {
+			break;
+		}
+		if (state == State::Receiving || state == State::Verifying) {
+			if (written + chunk.length > partition->size || !eraseTo(written + chunk.length) || esp_partition_write(partition, written, buffers[chunk.buffer], chunk.length) != ESP_OK) {
+				error = "Flash write failed";
+				state = State::Failed;
+			} else {
+				mbedtls_sha256_update(&sha, buffers[chunk.buffer], chunk.length);
+				written += chunk.length;
+			}
+		}
+		xSemaphoreGive(bufferFree);
+	}
+	if (state == State::Verifying) {
+		uint8_t digest[32];
+		mbedtls_sha256_finish(&sha, digest);
+		char hash[65];
+		for (int i = 0; i < 32; i++) {
+			sprintf(hash + i * 2, "%02x", digest[i]);
+		}
+		if (expectedHash != "" && expectedHash != hash) {
+			error = "SHA-256 mismatch";
+			state = State::Failed;
+		} else {
+			// Also checks the image is valid
+			esp_err_t result = esp_ota_set_boot_partition(partition);
+			if (result == ESP_OK) {
+				LOG_INFO(updateLog, "Update of %u bytes verified, SHA-256 %s", written, hash);
+				state = State::Done;
+			} else {
+				error = esp_err_to_name(result);
+				state = State::Failed;
+			}
+		}
+		if (state == State::Failed) {
+			LOG_ERROR(updateLog, "Update failed: %s", error.c_str());
+		}
+	}
+	mbedtls_sha256_free(&sha);
+	release();
+	writerHandle = NULL;
+	vTaskDelete(NULL);
+}
\ No newline at end of file
@@ -0,0 +1,103 @@
+/*
+* This file and associated .cpp file are licensed under the GPLv3 License Copyright (c) 2024 Sam Groveman
+* Contributors: Sam Groveman
+*/
+
+#pragma once
+#include <Arduino.h>
+#include <LogBroadcaster.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+
+/// @brief Writes firmware updates through a pipeline. Received data fills one buffer while a writer task erases ahead, writes and hashes the other, and an interrupted upload can be resumed from where it stopped
+class FirmwareUpdater {
+	public:
+		/// @brief Progress of an update
+		enum class State { Idle, Receiving, Verifying, Done, Failed };
+
+		static bool begin(size_t offset, size_t size = 0, String sha256 = "");
+		static bool write(const uint8_t* data, size_t len);
+		static bool finish();
+		static void abort(String reason);
+		static State getState();
+		static size_t getReceived();
+		static String getError();
+		static String getStatus();
+
+	private:
+		/// @brief Size in bytes of each receive buffer, one flash sector
+		static const size_t bufferSize = 4096;
+
+		/// @brief Size in bytes erased at a time, one flash block
+		static const size_t eraseSize = 65536;
+
+		/// @brief How far in bytes to erase ahead of the data when the image size isn't known
+		static const size_t eraseAhead = 4 * eraseSize;
+
+		/// @brief Longest time in ms to wait for the writer to free a buffer or verify the image
+		static const uint32_t writerTimeout = 10000;
+
+		/// @brief A filled buffer handed to the writer task. A length of 0 ends the update
+		struct Chunk {
+			/// @brief Which buffer
+			uint8_t buffer;
+
+			/// @brief Bytes of data in the buffer
+			size_t length;
+		};
+
+		/// @brief The two receive buffers
+		static uint8_t* buffers[2];
+
+		/// @brief The buffer being filled
+		static uint8_t active;
+
+		/// @brief Bytes in the buffer being filled
+		static size_t fill;
+
+		/// @brief Filled buffers waiting for the writer task
+		static QueueHandle_t chunkQueue;
+
+		/// @brief Given by the writer task each time it's done with a buffer
+		static SemaphoreHandle_t bufferFree;
+
+		/// @brief Task handle for the writer task
+		static TaskHandle_t writerHandle;
+
+		/// @brief The partition being written
+		static const esp_partition_t* partition;
+
+		/// @brief Running hash of the image
+		static mbedtls_sha256_context sha;
+
+		/// @brief Expected SHA-256 of the image as hex, empty if not given
+		static String expectedHash;
+
+		/// @brief Why the update failed
+		static String error;
+
+		/// @brief Size of the image in bytes, 0 if not known
+		static size_t imageSize;
+
+		/// @brief Bytes of the image received
+		static size_t received;
+
+		/// @brief Bytes of data at the start of the current upload already received by an earlier one
+		static size_t skip;
+
+		/// @brief Bytes of the image written to flash
+		static volatile size_t written;
+
+		/// @brief Bytes of the partition erased
+		static volatile size_t erased;
+
+		/// @brief Progress of the update
+		static volatile State state;
+
+		static bool submit(size_t length);
+		static bool eraseTo(size_t end);
+		static void stopWriter();
+		static void release();
+		static void writer(void* arg);
+};
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "LiveStream.h"
+
+// Initialize static variables
+volatile uint32_t LiveStream::droppedClients = 0;
+volatile uint32_t LiveStream::droppedMessages = 0;
+
+/// @brief Global live stream definition
+LiveStream LiveStreamer;
+
+/// @brief Creates a live stream
+/// @param Path The path clients connect to
+LiveStream::LiveStream(String Path) : events(Path) {
+	LogReceiver::Description.name = "Live Stream";
+	LogReceiver::Description.version = "0.01";
+	EventReceiver::Description.name = "Live Stream";
+	EventReceiver::Description.version = "0.01";
+	// Stream every event, including data events
+	eventFilter = UINT32_MAX;
+}
+
+/// @brief Starts the live stream
+/// @return True on success
+bool LiveStream::begin() {
+	if (clientMutex == NULL) {
+		clientMutex = xSemaphoreCreateMutex();
+	}
+	return clientMutex != NULL;
+}
+
+/// @brief Adds the stream to a web server until detached
+/// @param server The web server
+/// @param auth The authentication middleware for the stream
+/// @return True on success
+bool LiveStream::attach(AsyncWebServer* server, AsyncMiddleware* auth) {
+	if (attached || !begin()) {
+		return false;
+	}
+	events.onConnect([this](AsyncEventSourceClient* client) {
+		client->send("connected", "hello", lastID, 1000);
+		if (xSemaphoreTake(clientMutex, portMAX_DELAY) == pdTRUE) {
+			clients.push_back(client);
+			clientTotal = clients.size();
+			xSemaphoreGive(clientMutex);
+		}
+	});
+	events.onDisconnect([this](AsyncEventSourceClient* client) {
+		// Clients closed by streamToClients disconnect on its task while it holds the mutex, and are already removed
+		if (closingTask == xTaskGetCurrentTaskHandle()) {
+			return;
+		}
+		if (xSemaphoreTake(clientMutex, portMAX_DELAY) == pdTRUE) {
+			clients.erase(std::remove(clients.begin(), clients.end(), client), clients.end());
+			clientTotal = clients.size();
+			xSemaphoreGive(clientMutex);
+		}
+	});
+	server->addHandler(&events).addMiddleware(auth);
+	attached = true;
+	return true;
+}
+
+/// @brief Removes the stream from a web server and disconnects all clients. Call before resetting the server
+/// @param server The web server
+void LiveStream::detach(AsyncWebServer* server) {
+	if (!attached) {
+		return;
+	}
+	if (xSemaphoreTake(clientMutex, portMAX_DELAY) == pdTRUE) {
+		clients.clear();
+		clientTotal = 0;
+		xSemaphoreGive(clientMutex);
+	}
+	events.close();
+	// Take back ownership so resetting the server doesn't delete the event source
+	server->removeHandler(&events);
+	attached = false;
+}
+
+/// @brief Gets the number of connected clients
+/// @return The number of clients
+size_t LiveStream::clientCount() {
+	return clientTotal;
+}
+
+/// @brief Streams a log message to all clients
+/// @param message The message
+/// @return True on success
+bool LiveStream::receiveMessage(const String& message) {
+	streamToClients(message.c_str(), "log");
+	return true;
+}
+
+/// @brief Streams a log character to all clients
+/// @param message The character
+/// @return True on success
+bool LiveStream::receiveMessage(const char& message) {
+	char text[2] = { message, '\0' };
+	streamToClients(text, "log");
+	return true;
+}
+
+/// @brief Streams a batch of log text to all clients as one message. Binary logs are sent base64 encoded as "logbin" events, since records hold bytes server-sent events can't carry
+/// @param batch The batch of log text
+/// @return True on success
+bool LiveStream::receiveMessages(const LogBatch& batch) {
+	// Skip the copy entirely when nobody is listening
+	if (clientTotal == 0) {
+		return true;
+	}
+	#ifdef FABRICA_LOG_BINARY
+		std::vector<uint8_t> data(batch.first, batch.first + batch.firstLength);
+		data.insert(data.end(), batch.second, batch.second + batch.secondLength);
+		streamToClients(base64::encode(data.data(), data.size()).c_str(), "logbin");
+	#else
+		String text;
+		text.reserve(batch.length());
+		text.concat(batch.first, batch.firstLength);
+		if (batch.secondLength > 0) {
+			text.concat(batch.second, batch.secondLength);
+		}
+		streamToClients(text.c_str(), "log");
+	#endif
+	return true;
+}
+
+/// @brief Streams an event to all clients as JSON
+/// @param data The event and its data
+/// @return True on success
+bool LiveStream::receiveEvent(const EventData& data) {
+	if (clientTotal == 0) {
+		return true;
+	}
+	// Allocate the JSON document
+	JsonDocument doc;
+	doc["event"] = data.event;
+	doc["subject"] = data.subject;
+	doc["value"] = data.value;
+	doc["code"] = data.code;
+	String output;
+	serializeJson(doc, output);
+	streamToClients(output.c_str(), "event");
+	return true;
+}
+
+/// @brief Queues a message on every client, closing clients that have fallen too far behind rather than waiting on them
+/// @param message The message
+/// @param type The type of server-sent event
+void LiveStream::streamToClients(const char* message, const char* type) {
+	// Never block the log or event processor on the client list
+	if (clientMutex == NULL || xSemaphoreTake(clientMutex, pdMS_TO_TICKS(10)) == pdFALSE) {
+		droppedMessages++;
+		return;
+	}
+	lastID++;
+	for (auto client = clients.begin(); client != clients.end();) {
+		if ((*client)->packetsWaiting() >= maxWaitingMessages || !(*client)->send(message, type, lastID)) {
+			// Client can't keep up, remove and close it. Closing calls the disconnect callback on this task, which sees it's the closing task and skips rather than waiting on the mutex held here
+			AsyncEventSourceClient* slow = *client;
+			client = clients.erase(client);
+			closingTask = xTaskGetCurrentTaskHandle();
+			slow->close();
+			closingTask = nullptr;
+			droppedClients++;
+			clientTotal = clients.size();
+		} else {
+			client++;
+		}
+	}
+	xSemaphoreGive(clientMutex);
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+/*
+* This file and associated .cpp file are licensed under the GPLv3 License Copyright (c) 2024 Sam Groveman
+*
+* External libraries needed:
+* ESPAsyncWebServer: https://github.com/ESP32Async/ESPAsyncWebServer
+* ArduinoJSON: https://arduinojson.org/
+*
+* Contributors: Sam Groveman
+*/
+
+#pragma once
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+#include <LogReceiver.h>
+#include <EventReceiver.h>
+#include <algorithm>
+#include <vector>
+#ifdef FABRICA_LOG_BINARY
+#include <base64.h>
+#endif
+
+/// @brief Streams log text and events live to web clients using server-sent events
+class LiveStream : public LogReceiver, public EventReceiver {
+	public:
+		/// @brief Number of clients closed because they fell too far behind
+		static volatile uint32_t droppedClients;
+
+		/// @brief Number of messages not streamed because the client list was busy
+		static volatile uint32_t droppedMessages;
+
+		using LogReceiver::receiveMessage;
+		using EventReceiver::receiveEvent;
+
+		LiveStream(String Path = "/live");
+		bool begin() override;
+		bool attach(AsyncWebServer* server, AsyncMiddleware* auth);
+		void detach(AsyncWebServer* server);
+		bool receiveMessage(const String& message) override;
+		bool receiveMessage(const char& message) override;
+		bool receiveMessages(const LogBatch& batch) override;
+		bool receiveEvent(const EventData& data) override;
+		size_t clientCount();
+
+	private:
+		/// @brief Number of messages a client can have waiting before it's considered too slow and closed
+		static const size_t maxWaitingMessages = 16;
+
+		/// @brief The event source clients connect to. Lent to the web server while attached, but never deleted since closing clients call back into it
+		AsyncEventSource events;
+
+		/// @brief True while the event source is added to a web server
+		bool attached = false;
+
+		/// @brief The currently connected clients
+		std::vector<AsyncEventSourceClient*> clients;
+
+		/// @brief Number of connected clients, readable without taking the mutex
+		volatile size_t clientTotal = 0;
+
+		/// @brief Mutex protecting the client collection
+		SemaphoreHandle_t clientMutex = NULL;
+
+		/// @brief The task closing a slow client while holding the mutex, so the disconnect callback it triggers knows not to wait on the mutex. Null otherwise
+		volatile TaskHandle_t closingTask = nullptr;
+
+		/// @brief ID of the last message sent, lets clients detect gaps
+		uint32_t lastID = 0;
+
+		void streamToClients(const char* message, const char* type);
+};
+
+/// @brief Global live stream of logs and events
+extern LiveStream LiveStreamer;
\ No newline at end of file
@@ -1,7 +1,14 @@
 #include "LogBroadcaster.h"
 
 // Initialize static variables
-QueueHandle_t LogBroadcaster::messageQueue = xQueueCreate(15, sizeof(String*));
+char LogBroadcaster::ring[LogBroadcaster::ringCapacity];
+size_t LogBroadcaster::ringHead = 0;
+size_t LogBroadcaster::ringTail = 0;
+size_t LogBroadcaster::ringReserved = 0;
+portMUX_TYPE LogBroadcaster::ringLock = portMUX_INITIALIZER_UNLOCKED;
+volatile uint32_t LogBroadcaster::droppedBytes = 0;
+size_t LogBroadcaster::batchSize = 1024;
+uint32_t LogBroadcaster::flushInterval = 200;
 bool LogBroadcaster::noReceivers = true;
 TaskHandle_t LogBroadcaster::loggerHandle = nullptr;
 SemaphoreHandle_t LogBroadcaster::taskMutex = xSemaphoreCreateMutex();
@@ -55,12 +62,48 @@ String LogBroadcaster::getReceiverVersions() {
 	return output;
 }
 
+/// @brief Gets the run time log level of every module
+/// @return A JSON string mapping module names to levels
+String LogBroadcaster::getModuleLevels() {
+	// Allocate the JSON document
+	JsonDocument doc;
+	JsonObject modules = doc["modules"].to<JsonObject>();
+	for (const auto& m : LogModule::getModules()) {
+		modules[m->name] = static_cast<int>(m->level);
+	}
+	doc["compiled"] = FABRICA_LOG_LEVEL;
+	#ifdef FABRICA_LOG_BINARY
+		doc["binary"] = true;
+	#else
+		doc["binary"] = false;
+	#endif
+	String output;
+	serializeJson(doc, output);
+	return output;
+}
+
+/// @brief Sets the run time log level of a module
+/// @param module The name of the module
+/// @param level The new level (0 none, 1 error, 2 warn, 3 info, 4 debug, 5 trace). Levels above FABRICA_LOG_LEVEL have no effect
+/// @return True on success
+bool LogBroadcaster::setModuleLevel(String module, int level) {
+	if (level < static_cast<int>(LogLevel::None) || level > static_cast<int>(LogLevel::Trace)) {
+		return false;
+	}
+	for (const auto& m : LogModule::getModules()) {
+		if (module == m->name) {
+			m->level = static_cast<LogLevel>(level);
+			return true;
+		}
+	}
+	return false;
+}
+
 /// @brief Writes a char to all receivers
 /// @param c The char to write
 /// @return The number of bytes written (1)
 size_t LogBroadcaster::write(uint8_t c) {
-	String* message = new String((char)c);
-	return addMessageToQueue(message);
+	return addToRing(&c, 1);
 }
 
 /// @brief Writes a char* array buffer to all receivers
@@ -68,41 +111,131 @@ size_t LogBroadcaster::write(uint8_t c) {
 /// @param size The size of the buffer
 /// @return The number of bytes written
 size_t LogBroadcaster::write(const uint8_t *buffer, size_t size) {
-	String* message = new String((char*)buffer);
-	return addMessageToQueue(message, size);
+	return addToRing(buffer, size);
 }
 
-/// @brief Adds a message string to the queue
-/// @param message The string pointer to add
+/// @brief Copies data into the log ring without blocking. When the ring is full the oldest lines or records are dropped whole
+/// @param buffer The buffer to add
 /// @param size The size of the buffer
+/// @param whole True to drop all of the data rather than part of it if it doesn't fit, used for binary records
 /// @return The number of bytes written
-size_t LogBroadcaster::addMessageToQueue(String* message, size_t size) {
+size_t LogBroadcaster::addToRing(const uint8_t *buffer, size_t size, bool whole) {
+	// Keep a copy in the tail that survives resets, even if there are no receivers
+	LogTail::append(buffer, size);
 	if (noReceivers) {
 		// Ignore message (return message size since this is not an error)
-		delete message;
 		return size;
 	}
-	if (xSemaphoreTake(taskMutex, pdMS_TO_TICKS(500)) == pdFALSE) {
-		delete message;
-		return 0;
+	portENTER_CRITICAL(&ringLock);
+	size_t free = ringCapacity - (ringHead - ringTail);
+	if (size > free && ringReserved == 0) {
+		// Make room by dropping the oldest lines or records whole, unless receivers are currently reading them
+		size_t drop = nextEntry(ringTail + size - free) - ringTail;
+		ringTail += drop;
+		free += drop;
+		droppedBytes += drop;
 	}
+	// Drop any part of the new data that still doesn't fit
+	size_t count = whole && size > free ? 0 : std::min(size, free);
+	droppedBytes += size - count;
+	size_t pending = ringHead - ringTail;
+	size_t offset = ringHead % ringCapacity;
+	size_t first = std::min(count, ringCapacity - offset);
+	memcpy(ring + offset, buffer, first);
+	memcpy(ring, buffer + first, count - first);
+	ringHead += count;
+	// Only wake once per batch, when the pending data first reaches the batch size
+	size_t threshold = std::min(batchSize, ringCapacity / 2);
+	bool wake = pending < threshold && ringHead - ringTail >= threshold;
+	portEXIT_CRITICAL(&ringLock);
+
+	// Wake processor to deliver a full batch. Reading the handle is atomic, so the task mutex isn't needed
 	TaskHandle_t loggerTaskCopy = loggerHandle;
-	xSemaphoreGive(taskMutex);
-	if(loggerTaskCopy == nullptr) {
-		// Message processor loop not running when it should be
-		delete message;
-		return 0;
-	}
-	// Add message to queue
-	if (xQueueSend(messageQueue, &message, pdMS_TO_TICKS(10000)) != pdTRUE) {
-		delete message;
-		// Could not add message to queue
-		return 0;
+	if (wake && loggerTaskCopy != nullptr) {
+		xTaskNotifyGive(loggerTaskCopy);
 	}
 	return size;
 }
 
-/// @brief Message processor task loop, processes all messages in queue and sends to receivers
+/// @brief Hands a region of the ring to every receiver as one batch. The region is passed in place, in at most two segments if it wraps
+/// @param start The ring position of the region
+/// @param length The length of the region in bytes
+void LogBroadcaster::deliver(size_t start, size_t length) {
+	size_t offset = start % ringCapacity;
+	size_t first = std::min(length, ringCapacity - offset);
+	LogBatch batch = { ring + offset, first, first < length ? ring : nullptr, length - first };
+	try { // Try/catch is not a great solution here, should be improved
+		for (const auto& r : receivers) {
+			if (!r->receiveMessages(batch)) {
+				Logger.printf("Error with log receiver %s\n", r->Description.name.c_str());
+			}
+		}
+	}
+	catch (...) {
+		Logger.println("Exception in processing log message from queue");
+	}
+}
+
+/// @brief Finds the end of the last complete line in a region of the ring. Binary records are stepped over whole, since their bytes can include newlines
+/// @param start The ring position of the region
+/// @param length The length of the region in bytes
+/// @return The length of the region up to the end of the last complete line or record
+size_t LogBroadcaster::completeLength(size_t start, size_t length) {
+	#ifdef FABRICA_LOG_BINARY
+		size_t complete = 0;
+		for (size_t at = 0; at < length;) {
+			uint8_t byte = ring[(start + at) % ringCapacity];
+			if (byte == binaryMarker && at + binaryHeaderSize <= length) {
+				// Records are added to the ring whole, so one that starts here also ends here
+				at += binaryHeaderSize + static_cast<uint8_t>(ring[(start + at + 2) % ringCapacity]);
+				complete = std::min(at, length);
+			} else {
+				at++;
+				if (byte == '\n') {
+					complete = at;
+				}
+			}
+		}
+		return complete;
+	#else
+		size_t complete = length;
+		while (complete > 0 && ring[(start + complete - 1) % ringCapacity] != '\n') {
+			complete--;
+		}
+		return complete;
+	#endif
+}
+
+/// @brief Finds where the first line or binary record at or after a ring position starts, so dropping data up to there leaves no partial entry at the tail. Call with the ring lock held
+/// @param target The ring position
+/// @return The ring position of the entry, or the head of the ring if no entry starts after the target
+size_t LogBroadcaster::nextEntry(size_t target) {
+	// Walk from the tail, which is always at the start of an entry or within a text line
+	size_t at = ringTail;
+	bool boundary = true;
+	while (at < ringHead) {
+		uint8_t byte = ring[at % ringCapacity];
+		#ifdef FABRICA_LOG_BINARY
+			bool record = byte == binaryMarker && ringHead - at >= binaryHeaderSize;
+		#else
+			bool record = false;
+		#endif
+		if (at >= target && (boundary || record)) {
+			return at;
+		}
+		if (record) {
+			// Step over the record whole, its bytes can include newlines
+			at = std::min(at + binaryHeaderSize + static_cast<uint8_t>(ring[(at + 2) % ringCapacity]), ringHead);
+			boundary = true;
+		} else {
+			at++;
+			boundary = byte == '\n';
+		}
+	}
+	return ringHead;
+}
+
+/// @brief Message processor task loop, delivers log text from the ring to receivers in batches
 /// @param arg Not used
 void LogBroadcaster::messageProcessor(void* arg) {
 	if (noReceivers) {
@@ -113,23 +246,48 @@ void LogBroadcaster::messageProcessor(void* arg) {
 		vTaskDelete(NULL);
 		return;
 	}
-	String* message;
-	// Process all messages in the queue
-	while (xQueueReceive(messageQueue, &message, portMAX_DELAY) == pdTRUE) {
-		try { // Try/catch is not a great solution here, should be improved
-			for (const auto& r : Logger.receivers) {
-				if (!r->receiveMessage(*message)) {
-					Logger.printf("Error with log receiver %s", r->Description.name);
-				}
-			}
+	while (true) {
+		// Wait for a full batch, or time out so pending text is delivered at least once per flush interval
+		bool timedOut = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(flushInterval)) == 0;
+		// Reserve all pending data so writers won't overwrite it while it's being read
+		portENTER_CRITICAL(&ringLock);
+		size_t start = ringTail;
+		size_t length = ringHead - ringTail;
+		ringReserved = length;
+		portEXIT_CRITICAL(&ringLock);
+		if (length == 0) {
+			continue;
+		}
+		// Only deliver up to the last complete line when woken early, the partial line goes with the next batch
+		size_t deliverable = length;
+		if (!timedOut && length < ringCapacity / 2) {
+			deliverable = completeLength(start, length);
 		}
-		catch (...) {
-			Logger.println("Exception in processing log message from queue");
+		if (deliverable > 0) {
+			deliver(start, deliverable);
 		}
-		delete message;
+		// Release the delivered data
+		portENTER_CRITICAL(&ringLock);
+		ringTail = start + deliverable;
+		ringReserved = 0;
+		portEXIT_CRITICAL(&ringLock);
 	}
-	xSemaphoreTake(taskMutex, portMAX_DELAY);
-	loggerHandle = nullptr;
-	xSemaphoreGive(taskMutex);
-	vTaskDelete(NULL);
+}
+
+/// @brief Creates and registers a log module
+/// @param Name The name of the module, must stay valid for the life of the program
+/// @param Level The initial run time log level
+LogModule::LogModule(const char* Name, LogLevel Level) {
+	name = Name;
+	id = logHash(Name);
+	level = Level;
+	getModules().push_back(this);
+}
+
+/// @brief Gets all registered log modules
+/// @return A reference to the collection of modules
+std::vector<LogModule*>& LogModule::getModules() {
+	// Function scoped so modules declared at file scope in other files can register during static initialization
+	static std::vector<LogModule*> modules;
+	return modules;
 }
\ No newline at end of file
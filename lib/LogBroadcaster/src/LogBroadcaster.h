@@ -11,8 +11,75 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <LogReceiver.h>
+#include <LogTail.h>
+#include <type_traits>
 #include <vector>
 
+/// @brief Highest log level compiled in (0 none, 1 error, 2 warn, 3 info, 4 debug, 5 trace). Leveled log calls above it are removed from the build. Set with a build flag, e.g. -DFABRICA_LOG_LEVEL=3 for production
+#ifndef FABRICA_LOG_LEVEL
+#define FABRICA_LOG_LEVEL 4
+#endif
+
+/// @brief Logs a printf style message at a level for a module. Removed at compile time if the level is above FABRICA_LOG_LEVEL, otherwise skipped at run time if above the module's level
+#ifdef FABRICA_LOG_BINARY
+// Binary mode records the format ID and raw arguments, decoded on the host with log-decoder.py
+#define LOG_AT(module, level, format, ...) do { \
+	if (static_cast<int>(level) <= FABRICA_LOG_LEVEL && (module).enabled(level)) { \
+		constexpr uint32_t formatID = logHash(format); \
+		Logger.logRecord(level, (module).id, formatID, ##__VA_ARGS__); \
+	} \
+} while (0)
+#else
+#define LOG_AT(module, level, format, ...) do { \
+	if (static_cast<int>(level) <= FABRICA_LOG_LEVEL && (module).enabled(level)) { \
+		Logger.printf("[%c][%s] " format "\n", LogModule::levelChar(level), (module).name, ##__VA_ARGS__); \
+	} \
+} while (0)
+#endif
+#define LOG_ERROR(module, format, ...) LOG_AT(module, LogLevel::Error, format, ##__VA_ARGS__)
+#define LOG_WARN(module, format, ...) LOG_AT(module, LogLevel::Warn, format, ##__VA_ARGS__)
+#define LOG_INFO(module, format, ...) LOG_AT(module, LogLevel::Info, format, ##__VA_ARGS__)
+#define LOG_DEBUG(module, format, ...) LOG_AT(module, LogLevel::Debug, format, ##__VA_ARGS__)
+#define LOG_TRACE(module, format, ...) LOG_AT(module, LogLevel::Trace, format, ##__VA_ARGS__)
+
+/// @brief Log message severities, lower is more severe
+enum class LogLevel : uint8_t { None, Error, Warn, Info, Debug, Trace };
+
+/// @brief Computes the 32-bit FNV-1a hash of a string, used to identify log formats and modules in binary logs
+/// @param text The string to hash
+/// @param hash The running hash value
+/// @return The hash
+constexpr uint32_t logHash(const char* text, uint32_t hash = 2166136261u) {
+	return *text ? logHash(text + 1, (hash ^ static_cast<uint8_t>(*text)) * 16777619u) : hash;
+}
+
+/// @brief A named source of log messages with its own run time verbosity. Declare one per module at file scope
+class LogModule {
+	public:
+		/// @brief The name of the module
+		const char* name;
+
+		/// @brief The hash of the name, identifies the module in binary logs
+		uint32_t id;
+
+		/// @brief The most verbose level currently logged by this module
+		volatile LogLevel level;
+
+		LogModule(const char* Name, LogLevel Level = LogLevel::Info);
+
+		/// @brief Checks if messages at a level are currently logged
+		/// @param messageLevel The level of the message
+		/// @return True if the message should be logged
+		bool enabled(LogLevel messageLevel) const { return messageLevel <= level; }
+
+		/// @brief Gets the character used to tag a level in log output
+		/// @param messageLevel The level
+		/// @return The tag character
+		static char levelChar(LogLevel messageLevel) { return "-EWIDT"[static_cast<int>(messageLevel)]; }
+
+		static std::vector<LogModule*>& getModules();
+};
+
 /// @brief Used to broadcast log messages to all receivers
 class LogBroadcaster : public Print {
 	public:
@@ -25,21 +92,111 @@ class LogBroadcaster : public Print {
 		/// @brief Mutex for protecting access to task handle
 		static SemaphoreHandle_t taskMutex;
 
+		/// @brief Number of bytes dropped because the ring was full
+		static volatile uint32_t droppedBytes;
+
+		/// @brief Pending bytes that wake the processor to deliver a batch before the flush interval passes
+		static size_t batchSize;
+
+		/// @brief Longest time in ms log text waits in the ring before it's delivered
+		static uint32_t flushInterval;
+
 		bool beginReceivers();
 		bool addReceiver(LogReceiver* receiver);
 		String getReceiverVersions();
+		static String getModuleLevels();
+		static bool setModuleLevel(String module, int level);
 		static void messageProcessor(void* arg);
 
+		/// @brief Marks the start of a binary log record
+		static const uint8_t binaryMarker = 0x1E;
+
+		/// @brief Size of a binary log record header: marker, level, payload length, module ID, format ID
+		static const size_t binaryHeaderSize = 11;
+
+		/// @brief Maximum size of the arguments in a binary log record
+		static const size_t binaryPayloadMax = 255;
+
+		/// @brief Writes a binary log record. Integers and pointers are stored as 4 bytes, 64-bit integers and floating point as 8, and strings as a length byte followed by the text, all little endian
+		/// @param level The level of the message
+		/// @param moduleID The ID of the module logging the message
+		/// @param formatID The ID of the message format
+		/// @param args The format arguments
+		template <typename... Args>
+		void logRecord(LogLevel level, uint32_t moduleID, uint32_t formatID, Args... args) {
+			uint8_t record[binaryHeaderSize + binaryPayloadMax];
+			size_t length = binaryHeaderSize;
+			((length = encodeArg(record, length, args)), ...);
+			record[0] = binaryMarker;
+			record[1] = static_cast<uint8_t>(level);
+			record[2] = length - binaryHeaderSize;
+			memcpy(record + 3, &moduleID, sizeof(moduleID));
+			memcpy(record + 7, &formatID, sizeof(formatID));
+			addToRing(record, length, true);
+		}
+
 	private:
 		/// @brief Stores all event receivers
 		static std::vector<LogReceiver*> receivers;
 
-		/// @brief Queue to hold messages to be processed
-		static QueueHandle_t messageQueue;
+		/// @brief Size of the log ring buffer in bytes, must be a power of two
+		static const size_t ringCapacity = 4096;
+
+		/// @brief Ring buffer holding log text waiting to be delivered
+		static char ring[ringCapacity];
+
+		/// @brief Total bytes ever written to the ring, the write position is this modulo the capacity
+		static size_t ringHead;
+
+		/// @brief Total bytes ever removed from the ring, the read position is this modulo the capacity
+		static size_t ringTail;
+
+		/// @brief Bytes at the tail of the ring currently being read by receivers, which can't be dropped
+		static size_t ringReserved;
+
+		/// @brief Spinlock protecting the ring positions
+		static portMUX_TYPE ringLock;
 
 		size_t write(uint8_t c);
 		size_t write(const uint8_t *buffer, size_t size);
-		size_t addMessageToQueue(String* message, size_t size = 1);
+		size_t addToRing(const uint8_t *buffer, size_t size, bool whole = false);
+		static void deliver(size_t start, size_t length);
+		static size_t completeLength(size_t start, size_t length);
+		static size_t nextEntry(size_t target);
+
+		/// @brief Appends one argument to a binary log record, truncating strings that don't fit
+		/// @param record The record being built
+		/// @param at The current length of the record
+		/// @param arg The argument to append
+		/// @return The new length of the record, unchanged if the argument doesn't fit
+		template <typename T>
+		static size_t encodeArg(uint8_t* record, size_t at, T arg) {
+			size_t space = binaryHeaderSize + binaryPayloadMax - at;
+			if constexpr (std::is_convertible<T, const char*>::value) {
+				const char* text = arg == nullptr ? "(null)" : static_cast<const char*>(arg);
+				if (space == 0) {
+					return at;
+				}
+				size_t count = std::min(strlen(text), space - 1);
+				record[at] = count;
+				memcpy(record + at + 1, text, count);
+				return at + 1 + count;
+			} else {
+				// Widen to the size the decoder expects for the matching conversion
+				typename std::conditional<std::is_floating_point<T>::value, double,
+					typename std::conditional<(sizeof(T) > 4), uint64_t, uint32_t>::type>::type value;
+				if constexpr (std::is_pointer<T>::value) {
+					value = reinterpret_cast<uintptr_t>(arg);
+				} else {
+					value = arg;
+				}
+				if (space < sizeof(value)) {
+					return at;
+				}
+				memcpy(record + at, &value, sizeof(value));
+				return at + sizeof(value);
+			}
+		}
 };
 
 /// @brief Global log broadcaster
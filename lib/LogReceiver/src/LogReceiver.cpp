@@ -4,4 +4,25 @@
 /// @return True on success
 bool LogReceiver::begin() {
 	return true;
+}
+
+/// @brief Receives a span of log text directly from the log ring. Override to avoid the String copy made by default
+/// @param message Pointer to the log text, only valid for the duration of the call
+/// @param length The length of the log text in bytes
+/// @return True on success
+bool LogReceiver::receiveMessage(const char* message, size_t length) {
+	String text;
+	text.concat(message, length);
+	return receiveMessage(text);
+}
+
+/// @brief Receives a batch of log text gathered since the last delivery. Override to write each batch in one operation (e.g. one file append or network packet)
+/// @param batch The batch of log text, only valid for the duration of the call
+/// @return True on success
+bool LogReceiver::receiveMessages(const LogBatch& batch) {
+	bool success = receiveMessage(batch.first, batch.firstLength);
+	if (batch.secondLength > 0) {
+		success &= receiveMessage(batch.second, batch.secondLength);
+	}
+	return success;
 }
\ No newline at end of file
@@ -7,6 +7,25 @@
 #pragma once
 #include <Arduino.h>
 
+/// @brief A batch of log text handed to receivers in place. The text may wrap around the end of the log ring, so it's split in at most two segments
+struct LogBatch {
+	/// @brief The first segment of text
+	const char* first;
+
+	/// @brief The length of the first segment in bytes
+	size_t firstLength;
+
+	/// @brief The second segment of text, nullptr if the batch didn't wrap
+	const char* second;
+
+	/// @brief The length of the second segment in bytes
+	size_t secondLength;
+
+	/// @brief Gets the total length of the batch
+	/// @return The length in bytes
+	size_t length() const { return firstLength + secondLength; }
+};
+
 /// @brief Class for log receivers devices to inherit to receive log messages from hub
 class LogReceiver {
 	public:
@@ -22,4 +41,6 @@ class LogReceiver {
 		virtual bool begin();
 		virtual bool receiveMessage(const String& message) = 0;
 		virtual bool receiveMessage(const char& message) = 0;
+		virtual bool receiveMessage(const char* message, size_t length);
+		virtual bool receiveMessages(const LogBatch& batch);
 };
\ No newline at end of file
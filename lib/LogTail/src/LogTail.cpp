@@ -0,0 +1,119 @@
+#include "LogTail.h"
+
+// Initialize static variables
+RTC_NOINIT_ATTR LogTail::TailState LogTail::state;
+bool LogTail::ready = false;
+String LogTail::previous;
+esp_reset_reason_t LogTail::resetReason = ESP_RST_UNKNOWN;
+portMUX_TYPE LogTail::tailLock = portMUX_INITIALIZER_UNLOCKED;
+
+/// @brief Recovers the tail left by the previous boot if it's intact, then starts a new tail. Call before anything is logged
+void LogTail::begin() {
+	if (ready) {
+		return;
+	}
+	resetReason = esp_reset_reason();
+	// After power on the memory holds garbage, which the magic and checksums catch
+	uint32_t dataSum = sumData(0, FABRICA_LOG_TAIL_SIZE, state.data);
+	if (resetReason != ESP_RST_POWERON && state.magic == tailMagic && state.checksum == computeChecksum() && state.dataSum == dataSum) {
+		size_t length = std::min<size_t>(state.head, FABRICA_LOG_TAIL_SIZE);
+		size_t start = (state.head - length) % FABRICA_LOG_TAIL_SIZE;
+		size_t first = std::min(length, FABRICA_LOG_TAIL_SIZE - start);
+		previous.reserve(length);
+		previous.concat(reinterpret_cast<const char*>(state.data + start), first);
+		previous.concat(reinterpret_cast<const char*>(state.data), length - first);
+	}
+	// Start a new tail, the old data is overwritten as new output arrives
+	state.magic = tailMagic;
+	state.head = 0;
+	state.checksum = computeChecksum();
+	state.dataSum = dataSum;
+	ready = true;
+}
+
+/// @brief Copies log output into the tail, overwriting the oldest output. Space is reserved under a short lock and copied outside it, so concurrent writers fill their own regions
+/// @param buffer The log output
+/// @param size The size of the output in bytes
+void LogTail::append(const uint8_t* buffer, size_t size) {
+	if (!ready || size == 0) {
+		return;
+	}
+	// Only the end of a large write can fit
+	if (size > FABRICA_LOG_TAIL_SIZE) {
+		buffer += size - FABRICA_LOG_TAIL_SIZE;
+		size = FABRICA_LOG_TAIL_SIZE;
+	}
+	portENTER_CRITICAL(&tailLock);
+	size_t offset = state.head % FABRICA_LOG_TAIL_SIZE;
+	state.head += size;
+	state.checksum = computeChecksum();
+	portEXIT_CRITICAL(&tailLock);
+	size_t first = std::min(size, FABRICA_LOG_TAIL_SIZE - offset);
+	copyIn(offset, buffer, first);
+	copyIn(0, buffer + first, size - first);
+}
+
+/// @brief Gets the log tail recovered from before the last reset
+/// @return The log output, oldest first, or an empty string if none survived
+const String& LogTail::getPrevious() {
+	return previous;
+}
+
+/// @brief Gets the reason for the last reset
+/// @return A description of the reason
+String LogTail::getResetReason() {
+	switch (resetReason) {
+		case ESP_RST_POWERON:
+			return "Power on";
+		case ESP_RST_EXT:
+			return "External pin";
+		case ESP_RST_SW:
+			return "Software restart";
+		case ESP_RST_PANIC:
+			return "Panic";
+		case ESP_RST_INT_WDT:
+			return "Interrupt watchdog";
+		case ESP_RST_TASK_WDT:
+			return "Task watchdog";
+		case ESP_RST_WDT:
+			return "Watchdog";
+		case ESP_RST_DEEPSLEEP:
+			return "Deep sleep";
+		case ESP_RST_BROWNOUT:
+			return "Brownout";
+		default:
+			return "Unknown";
+	}
+}
+
+/// @brief Computes the checksum of the tail state, which catches the garbage left in RTC memory by a power loss
+/// @return The checksum
+uint32_t LogTail::computeChecksum() {
+	return ~(state.magic ^ state.head);
+}
+
+/// @brief Computes the position weighted sum of a region of the tail's data, so reordered or shifted bytes change it
+/// @param offset The position of the region in the tail
+/// @param size The size of the region in bytes
+/// @param buffer The bytes of the region
+/// @return The sum
+uint32_t LogTail::sumData(size_t offset, size_t size, const uint8_t* buffer) {
+	uint32_t sum = 0;
+	for (size_t i = 0; i < size; i++) {
+		sum += buffer[i] * (uint32_t)(offset + i + 1);
+	}
+	return sum;
+}
+
+/// @brief Copies bytes into a region of the tail reserved by append and adjusts the data sum by the change. Runs outside the lock, the adjustment is atomic so concurrent writers can't lose each other's changes
+/// @param offset The position of the region in the tail
+/// @param buffer The bytes to copy
+/// @param size The size of the region in bytes
+void LogTail::copyIn(size_t offset, const uint8_t* buffer, size_t size) {
+	if (size == 0) {
+		return;
+	}
+	uint32_t change = sumData(offset, size, buffer) - sumData(offset, size, state.data + offset);
+	memcpy(state.data + offset, buffer, size);
+	__atomic_fetch_add(&state.dataSum, change, __ATOMIC_RELAXED);
+}
\ No newline at end of file
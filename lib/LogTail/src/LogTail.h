@@ -0,0 +1,63 @@
+/*
+* This file and associated .cpp file are licensed under the GPLv3 License Copyright (c) 2024 Sam Groveman
+* Contributors: Sam Groveman
+*/
+
+#pragma once
+#include <Arduino.h>
+#include <esp_system.h>
+
+/// @brief Size in bytes of the log tail kept across reboots, should be a power of two. Set with a build flag, e.g. -DFABRICA_LOG_TAIL_SIZE=4096
+#ifndef FABRICA_LOG_TAIL_SIZE
+#define FABRICA_LOG_TAIL_SIZE 2048
+#endif
+
+/// @brief Keeps the most recent log output in RTC memory, which isn't cleared by a software reset, panic, or watchdog reset, so it can be read after the reboot
+class LogTail {
+	public:
+		static void begin();
+		static void append(const uint8_t* buffer, size_t size);
+		static const String& getPrevious();
+		static String getResetReason();
+
+	private:
+		/// @brief Log tail state kept in RTC memory
+		struct TailState {
+			/// @brief Set to tailMagic once the state has been initialized
+			uint32_t magic;
+
+			/// @brief Total bytes ever appended, the write position is this modulo the tail size
+			uint32_t head;
+
+			/// @brief Check value of the magic and head, kept up to date on each append
+			uint32_t checksum;
+
+			/// @brief Position weighted sum of the data, adjusted by each append after its bytes are copied in
+			uint32_t dataSum;
+
+			/// @brief The most recent log output
+			uint8_t data[FABRICA_LOG_TAIL_SIZE];
+		};
+
+		/// @brief Marks initialized tail state
+		static const uint32_t tailMagic = 0x4C6F6754;
+
+		/// @brief The tail state, survives any reset other than power loss
+		static TailState state;
+
+		/// @brief True once the tail has been checked and can be appended to
+		static bool ready;
+
+		/// @brief The tail recovered from before the last reset, oldest first
+		static String previous;
+
+		/// @brief Reason for the last reset
+		static esp_reset_reason_t resetReason;
+
+		/// @brief Spinlock protecting the head while space is reserved
+		static portMUX_TYPE tailLock;
+
+		static uint32_t computeChecksum();
+		static uint32_t sumData(size_t offset, size_t size, const uint8_t* buffer);
+		static void copyIn(size_t offset, const uint8_t* buffer, size_t size);
+};
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include "PeriodicTasks.h"
 
+// Runs every period, so per-run messages are logged at debug level
+static LogModule tasksLog("PeriodicTasks");
+
 // Initialize static variables
 std::unordered_map<std::string, std::function<void(long)>> PeriodicTasks::tasks;
 SemaphoreHandle_t PeriodicTasks::taskMutex = NULL;
@@ -22,28 +25,26 @@ bool PeriodicTasks::begin() {
 bool PeriodicTasks::callTasks(long elapsed) {
 	// Make a snapshot copy of the tasks under lock to avoid iterator invalidation
 	if (xSemaphoreTake(taskMutex, pdMS_TO_TICKS(1000)) == pdFALSE) {
-		Logger.println("Timed out taking task mutex");
+		LOG_ERROR(tasksLog, "Timed out taking task mutex");
 		return false;
 	}
 	auto snapshot = tasks;
 	xSemaphoreGive(taskMutex);
 
-	Logger.println("Running tasks...");
+	LOG_DEBUG(tasksLog, "Running tasks...");
 	// Ensure sensor measurement success
 	if (!SensorManager::takeMeasurement()) {
-		Logger.println("Sensor measurement failed");
+		LOG_ERROR(tasksLog, "Sensor measurement failed");
 		return false;
 	}
 	for (const auto& task : snapshot) {
-		Logger.print("Running task ");
-		Logger.println(task.first.c_str());
+		LOG_TRACE(tasksLog, "Running task %s", task.first.c_str());
 		try {
 			task.second(elapsed);
 		} catch (const std::exception &e) {
-			Logger.print("Task threw exception: ");
-			Logger.println(e.what());
+			LOG_ERROR(tasksLog, "Task %s threw exception: %s", task.first.c_str(), e.what());
 		} catch (...) {
-			Logger.println("Task threw unknown exception");
+			LOG_ERROR(tasksLog, "Task %s threw unknown exception", task.first.c_str());
 		}
 	}
 	return true;
@@ -71,8 +72,7 @@ bool PeriodicTasks::addTask(std::string name, std::function<void(long)> callback
 	}
 	// Only add if it doesn't already exist
 	if (tasks.find(name) == tasks.end()) {
-		Logger.print("Adding task ");
-		Logger.println(name.c_str());
+		LOG_INFO(tasksLog, "Adding task %s", name.c_str());
 		bool res = tasks.emplace(name, callback).second;
 		xSemaphoreGive(taskMutex);
 		return res;
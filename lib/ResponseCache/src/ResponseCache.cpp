@@ -0,0 +1,49 @@
+#include "ResponseCache.h"
+
+// Initialize static variables
+volatile uint32_t ResponseCache::generation = 0;
+std::map<String, ResponseCache::Entry> ResponseCache::entries;
+SemaphoreHandle_t ResponseCache::cacheMutex = xSemaphoreCreateMutex();
+
+/// @brief Gets a response, building it if it isn't cached or has changed since it was
+/// @param key The route and any parameters that select the response, e.g. "/sensors/config?sensor=0"
+/// @param build Builds the response body
+/// @return The response
+ResponseCache::Response ResponseCache::get(const String& key, std::function<String()> build) {
+	// Taken before building, so a change made while building leaves the entry stale
+	uint32_t current = generation;
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdTRUE) {
+		auto entry = entries.find(key);
+		if (entry != entries.end() && entry->second.generation == current) {
+			Response response = entry->second.response;
+			xSemaphoreGive(cacheMutex);
+			return response;
+		}
+		xSemaphoreGive(cacheMutex);
+	}
+	// Built outside the mutex as building can wait on devices
+	std::shared_ptr<const String> body = std::make_shared<const String>(build());
+	// Tagged by contents, so a body that's unchanged after a bump (or a reboot) still matches the browser's copy
+	char etag[24];
+	snprintf(etag, sizeof(etag), "\"%08x-%u\"", esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(body->c_str()), body->length()), body->length());
+	Response response { body, etag };
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdTRUE) {
+		if (entries.size() >= maxEntries && entries.find(key) == entries.end()) {
+			entries.clear();
+		}
+		entries[key] = { current, response };
+		xSemaphoreGive(cacheMutex);
+	}
+	return response;
+}
+
+/// @brief Marks all cached responses as changed. Call whenever devices are added or a configuration is changed
+void ResponseCache::invalidate() {
+	generation++;
+}
+
+/// @brief Gets the current generation, which changes whenever cached responses may have
+/// @return The generation
+uint32_t ResponseCache::getGeneration() {
+	return generation;
+}
\ No newline at end of file
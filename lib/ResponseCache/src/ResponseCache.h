@@ -0,0 +1,50 @@
+/*
+* This file and associated .cpp file are licensed under the GPLv3 License Copyright (c) 2024 Sam Groveman
+* Contributors: Sam Groveman
+*/
+
+#pragma once
+#include <Arduino.h>
+#include <esp_rom_crc.h>
+#include <functional>
+#include <map>
+#include <memory>
+
+/// @brief Keeps serialized responses that only change when devices or configurations do, so they're built once instead of on every request
+class ResponseCache {
+	public:
+		/// @brief A serialized response
+		struct Response {
+			/// @brief The body, shared with any responses still sending it
+			std::shared_ptr<const String> body;
+
+			/// @brief Entity tag of the body
+			String etag;
+		};
+
+		static Response get(const String& key, std::function<String()> build);
+		static void invalidate();
+		static uint32_t getGeneration();
+
+	private:
+		/// @brief A cached response and the generation it was built in
+		struct Entry {
+			/// @brief The generation the response was built in
+			uint32_t generation;
+
+			/// @brief The response
+			Response response;
+		};
+
+		/// @brief Most responses kept, one per route and device
+		static const size_t maxEntries = 32;
+
+		/// @brief Bumped whenever a cached response may have changed, entries from older generations are rebuilt
+		static volatile uint32_t generation;
+
+		/// @brief Cached responses by route and parameters
+		static std::map<String, Entry> entries;
+
+		/// @brief Mutex protecting the entries
+		static SemaphoreHandle_t cacheMutex;
+};
\ No newline at end of file
@@ -9,6 +9,7 @@ std::vector<SensorManager::measurement> SensorManager::measurements;
 /// @return True on success
 bool SensorManager::addSensor(Sensor* sensor) {
 	sensors.push_back(sensor);
+	ResponseCache::invalidate();
 	return true; // Currently no way to fail this
 }
 
@@ -26,6 +27,8 @@ bool SensorManager::beginSensors() {
 		}
 	}
 	measurements.resize(size);
+	// Descriptions are complete once sensors have started
+	ResponseCache::invalidate();
 	return true;
 }
 
@@ -34,7 +37,8 @@ bool SensorManager::beginSensors() {
 bool SensorManager::takeMeasurement() {
 	int index = 0;
 	// Take measurements
-	for (auto const &s : sensors) {
+	for (int sensorPosID = 0; sensorPosID < sensors.size(); sensorPosID++) {
+		Sensor* s = sensors[sensorPosID];
 		if (!s->takeMeasurement()) {
 			Logger.println("Error taking measurement from " + s->Description.name);
 			return false;
@@ -48,6 +52,8 @@ bool SensorManager::takeMeasurement() {
 				.unit = s->Description.units[i]
 			};
 			index++;
+			// Notify any receivers subscribed to this measurement
+			EventBroadcaster::broadcastEvent(EventBroadcaster::Events::Measurement, sensorPosID, s->values[i], i);
 		}
 	}
 	return true;
@@ -129,7 +135,10 @@ String SensorManager::getSensorConfig(String sensorName) {
 /// @return True on success
 bool SensorManager::setSensorConfig(int sensorPosID, String config) {
 	if (sensorPosID >= 0 && sensorPosID < sensors.size()) {
-		return sensors[sensorPosID]->setConfig(config, true);
+		bool success = sensors[sensorPosID]->setConfig(config, true);
+		// Even a rejected config may have been partly applied
+		ResponseCache::invalidate();
+		return success;
 	} else {
 		return false;
 	}
@@ -162,7 +171,10 @@ std::tuple<Sensor::calibration_response, String> SensorManager::calibrateSensor(
 		Logger.println("sensorPosID out of range");
 		return { Sensor::calibration_response::ERROR, "sensorPosID out of range" };
 	}
-	return sensors[sensorPosID]->calibrate(step);
+	std::tuple<Sensor::calibration_response, String> response = sensors[sensorPosID]->calibrate(step);
+	// Calibration can change the sensor's config
+	ResponseCache::invalidate();
+	return response;
 }
 
 /// @brief Turns the name of a sensor into its position ID
@@ -9,6 +9,8 @@
 
 #pragma once
 #include <Sensor.h>
+#include <EventBroadcaster.h>
+#include <ResponseCache.h>
 #include <vector>
 #include <ArduinoJson.h>
 
@@ -1,17 +1,31 @@
 #include "Storage.h"
 
+// File operations are logged at debug level, failures at warn
+static LogModule storageLog("Storage");
+
 // Initialize static variables
-Storage::Media Storage::storageMedia = Storage::Media::Not_Ready;
-FS* Storage::storageSystem = &LittleFS;
+Storage::Tier Storage::primary = { "", Storage::Media::Not_Ready, &LittleFS, false };
+std::vector<Storage::Tier> Storage::tiers;
+std::map<String, Storage::PathInfo> Storage::existsCache;
+std::map<String, std::vector<String>> Storage::listCache;
+std::map<String, String> Storage::readCache;
+size_t Storage::readCacheUsed = 0;
+std::map<String, uint8_t> Storage::heldPaths;
+std::map<String, Storage::DeferredWrite> Storage::deferredWrites;
+size_t Storage::deferredBytes = 0;
+SemaphoreHandle_t Storage::deferMutex = xSemaphoreCreateMutex();
+SemaphoreHandle_t Storage::cacheMutex = xSemaphoreCreateMutex();
 
 /// @brief Mount LittleFS and format if necessary
 /// @return True on successful mount of LittleFS
 bool Storage::begin() {
-	Logger.println("Mounting LittleFS, this could take a while, please wait...");
+	LOG_INFO(storageLog, "Mounting LittleFS, this could take a while, please wait...");
 	bool success = LittleFS.begin(true, "/sd");
 	if (success) {
-		storageSystem = &LittleFS;
-		storageMedia = Storage::Media::LittleFS;
+		primary.fs = &LittleFS;
+		primary.media = Storage::Media::LittleFS;
+		invalidateCache();
+		StorageWear::begin(LittleFS.totalBytes());
 	}
 	return success;
 }
@@ -28,33 +42,25 @@ bool Storage::begin(int sdi, int sdo, int sck, int cs, uint32_t frequency, SPICl
 	// Start SPI bus
 	spi.begin(sck, sdi, sdo);
 	bool success = true;
-	Logger.println("Mounting storage...");
+	LOG_INFO(storageLog, "Mounting storage...");
 	if (!SD.begin(cs, spi, frequency, "/sd")) {
-		Logger.println("Card mount failed, might need to format card as FAT32 or reduce clock frequency");
+		LOG_ERROR(storageLog, "Card mount failed, might need to format card as FAT32 or reduce clock frequency");
 		success = false;
 	} else {
 		uint8_t cardType = SD.cardType();
 		if (cardType == CARD_NONE) {
-			Logger.println("No SD card attached. Must be formatted as FAT32");
+			LOG_ERROR(storageLog, "No SD card attached. Must be formatted as FAT32");
 			success = false;
 		} else {
-			Logger.print("SD card type: ");
-			if (cardType == CARD_MMC) {
-				Logger.println("MMC");
-			} else if (cardType == CARD_SD) {
-				Logger.println("SDSC");
-			} else if (cardType == CARD_SDHC) {
-				Logger.println("SDHC");
-			} else {
-				Logger.println("UNKNOWN");
-			}
+			LOG_INFO(storageLog, "SD card type: %s", cardTypeName(cardType));
 			uint64_t cardSize = SD.cardSize() / 1048576; // 1024 * 1024
-			Logger.printf("SD card size: %lluMB\n", cardSize);
+			LOG_INFO(storageLog, "SD card size: %lluMB", cardSize);
 		}
 	}
 	if (success) {
-		storageSystem = &SD;
-		storageMedia = Storage::Media::SD_SPI;
+		primary.fs = &SD;
+		primary.media = Storage::Media::SD_SPI;
+		invalidateCache();
 	}
 	return success;
 }
@@ -72,76 +78,161 @@ bool Storage::begin(int sdi, int sdo, int sck, int cs, uint32_t frequency, SPICl
 bool Storage::begin(int clk, int cmd, int d0, int d1, int d2, int d3, uint32_t frequency) {
 	bool success = SD_MMC.setPins(clk, cmd, d0, d1, d2, d3);
 	if (success) {
-		Logger.println("Mounting storage...");
+		LOG_INFO(storageLog, "Mounting storage...");
 		if (!SD_MMC.begin("/sd", false, true, frequency)) {
-			Logger.println("Card mount failed, might need to reduce sd_mmc frequency to 10000 or lower");
+			LOG_ERROR(storageLog, "Card mount failed, might need to reduce sd_mmc frequency to 10000 or lower");
 			success = false;
 		} else {
 			uint8_t cardType = SD_MMC.cardType();
 
 			if(cardType == CARD_NONE) {
-				Logger.println("No SD_MMC card attached");
+				LOG_ERROR(storageLog, "No SD_MMC card attached");
 				success = false;
 			} else {
-				Logger.print("SD_MMC card type: ");
-				if (cardType == CARD_MMC) {
-					Logger.println("MMC");
-				} else if(cardType == CARD_SD) {
-					Logger.println("SDSC");
-				} else if(cardType == CARD_SDHC) {
-					Logger.println("SDHC");
-				} else {
-					Logger.println("UNKNOWN");
-				}
+				LOG_INFO(storageLog, "SD_MMC card type: %s", cardTypeName(cardType));
 				uint64_t cardSize = SD_MMC.cardSize() / 1048576; // 1024 * 1024
-				Logger.printf("SD_MMC card size: %lluMB\n", cardSize);
+				LOG_INFO(storageLog, "SD_MMC card size: %lluMB", cardSize);
 			}
 		}
 	}
 	if (success) {
-		storageSystem = &SD_MMC;
-		storageMedia = Storage::Media::SD_MMC;
+		primary.fs = &SD_MMC;
+		primary.media = Storage::Media::SD_MMC;
+		invalidateCache();
 	}
 	return success;
 }
 #endif
 
-/// @brief Gets the currently used file system
+/// @brief Gets the name of an SD card type for logging
+/// @param type The card type reported by the card driver
+/// @return The name of the type
+const char* Storage::cardTypeName(uint8_t type) {
+	switch (type) {
+		case CARD_MMC:
+			return "MMC";
+		case CARD_SD:
+			return "SDSC";
+		case CARD_SDHC:
+			return "SDHC";
+		default:
+			return "UNKNOWN";
+	}
+}
+
+/// @brief Stores paths starting with a prefix on another media, e.g. to keep small, frequently used files on internal flash while bulk data goes to an SD card. Call during setup after begin
+/// @param prefix The path prefix to route, e.g. "/www"
+/// @param media The media to store the paths on. LittleFS is mounted if needed, SD cards must already be mounted
+/// @param cacheReads True to keep small files read from the tier in memory. Only use for paths written through Storage's whole-file functions (e.g. settings), as writes through open files aren't seen by the cache
+/// @return True on success
+bool Storage::addTier(String prefix, Media media, bool cacheReads) {
+	Tier tier = { prefix, media, nullptr, cacheReads };
+	switch (media) {
+		case Storage::Media::LittleFS:
+			// Mount at its own point so it can sit alongside an SD card
+			if (primary.media != Storage::Media::LittleFS && !LittleFS.begin(true, "/littlefs")) {
+				LOG_ERROR(storageLog, "Could not mount LittleFS for %s", prefix.c_str());
+				return false;
+			}
+			tier.fs = &LittleFS;
+			StorageWear::begin(LittleFS.totalBytes());
+			break;
+		case Storage::Media::SD_SPI:
+			tier.fs = &SD;
+			break;
+		#ifdef SOC_SDMMC_HOST_SUPPORTED
+		case Storage::Media::SD_MMC:
+			tier.fs = &SD_MMC;
+			break;
+		#endif
+		default:
+			return false;
+	}
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdFALSE) {
+		return false;
+	}
+	tiers.push_back(tier);
+	// Match the most specific prefix first
+	std::sort(tiers.begin(), tiers.end(), [](const Tier& a, const Tier& b) {
+		return a.prefix.length() > b.prefix.length();
+	});
+	existsCache.clear();
+	listCache.clear();
+	xSemaphoreGive(cacheMutex);
+	LOG_INFO(storageLog, "Storing %s on media %d", prefix.c_str(), static_cast<int>(media));
+	return true;
+}
+
+/// @brief Gets the file system of the primary media. Changes made directly through it aren't seen by Storage's caches or space counters, so call invalidateCache afterwards, or use Storage's own functions
 /// @return A pointer to storage media/file system being used
 fs::FS* Storage::getFileSystem() {
-	return storageSystem; 
+	return primary.fs;
+}
+
+/// @brief Gets the file system a path is stored on, e.g. to serve a file from it. Changes made directly through it aren't seen by Storage's caches or space counters, so call invalidateCache afterwards, or use Storage's own functions
+/// @param path The path
+/// @return A pointer to the file system
+fs::FS* Storage::getFileSystem(String path) {
+	return tierFor(path).fs;
 }
 
-/// @brief Gets the currently used media type
+/// @brief Gets the primary media type
 /// @return The type of media in use
 Storage::Media Storage::getMediaType() {
-	return storageMedia;
+	return primary.media;
 }
 
-/// @brief List the files in a directory
+/// @brief List the files in a directory, from the cache if the directory hasn't changed
 /// @param dirname The directory path to list
 /// @param levels How many levels to recurse into the directory for listing
 /// @return A collection of strings of full paths of the files found
 std::vector<String> Storage::listFiles(String dirname, uint8_t levels) {
-	Logger.println("Listing directory: " + dirname);
+	String key = "F" + String(levels) + dirname;
+	std::vector<String> folderContents;
+	if (!cachedList(key, folderContents)) {
+		folderContents = scanFiles(dirname, levels);
+		cacheList(key, folderContents);
+	}
+	return folderContents;
+}
+
+/// @brief List the folders in a directory, from the cache if the directory hasn't changed
+/// @param dirname The directory path to list
+/// @param levels How many levels to recurse into the directory for listing
+/// @return A collection of strings of full paths of the directories
+std::vector<String> Storage::listDirs(String dirname, uint8_t levels) {
+	String key = "D" + String(levels) + dirname;
 	std::vector<String> folderContents;
-	File root = storageSystem->open(dirname);
+	if (!cachedList(key, folderContents)) {
+		folderContents = scanDirs(dirname, levels);
+		cacheList(key, folderContents);
+	}
+	return folderContents;
+}
+
+/// @brief Scans the media for the files in a directory
+/// @param dirname The directory path to list
+/// @param levels How many levels to recurse into the directory for listing
+/// @return A collection of strings of full paths of the files found
+std::vector<String> Storage::scanFiles(String dirname, uint8_t levels) {
+	LOG_DEBUG(storageLog, "Listing directory: %s", dirname.c_str());
+	std::vector<String> folderContents;
+	File root = tierFor(dirname).fs->open(dirname);
 	if(!root){
-		Logger.println("Failed to open directory");
+		LOG_WARN(storageLog, "Failed to open directory");
 		return folderContents;
 	}
 	if (!root.isDirectory()) {
-		Logger.println("Not a directory");
+		LOG_WARN(storageLog, "Not a directory");
 		return folderContents;
 	}
 	File file = root.openNextFile();
 	while(file) {
 		if(file.isDirectory()) {
-			Logger.print("  DIR : ");
-			Logger.println(file.name());
+			LOG_TRACE(storageLog, "  DIR : %s", file.name());
 			if(levels) {
 				// Recurse and add subdir contents to file list
-				for (const auto& f : listFiles(file.path(), levels - 1)) {
+				for (const auto& f : scanFiles(file.path(), levels - 1)) {
 					folderContents.push_back(f);
 				}
 			}
@@ -153,30 +244,30 @@ std::vector<String> Storage::listFiles(String dirname, uint8_t levels) {
 	return folderContents;
 }
 
-/// @brief List the folders in a directory
+/// @brief Scans the media for the folders in a directory
 /// @param dirname The directory path to list
 /// @param levels How many levels to recurse into the directory for listing
 /// @return A collection of strings of full paths of the directories
-std::vector<String> Storage::listDirs(String dirname, uint8_t levels) {
-	Logger.println("Listing directory: " + dirname);
+std::vector<String> Storage::scanDirs(String dirname, uint8_t levels) {
+	LOG_DEBUG(storageLog, "Listing directory: %s", dirname.c_str());
 	std::vector<String> folderContents;
-	File root = storageSystem->open(dirname);
+	File root = tierFor(dirname).fs->open(dirname);
 	if(!root){
-		Logger.println("Failed to open directory");
+		LOG_WARN(storageLog, "Failed to open directory");
 		return folderContents;
 	}
 	if (!root.isDirectory()) {
-		Logger.println("Not a directory");
+		LOG_WARN(storageLog, "Not a directory");
 		return folderContents;
 	}
 	File file = root.openNextFile();
 	while(file) {
 		if(file.isDirectory()) {
 			folderContents.push_back(String(file.path()));
-			Logger.println(file.name());
+			LOG_TRACE(storageLog, "  DIR : %s", file.name());
 			if(levels) {
 				// Recurse and add subdir contents to directory list
-				for (const auto& d : listDirs(file.path(), levels - 1)) {
+				for (const auto& d : scanDirs(file.path(), levels - 1)) {
 					folderContents.push_back(d);
 				}
 			}
@@ -190,60 +281,258 @@ std::vector<String> Storage::listDirs(String dirname, uint8_t levels) {
 /// @param path The path of the file or directory
 /// @return True if it exists
 bool Storage::fileExists(String path) {
-	Logger.println("Checking for file: " + path);
-	return storageSystem->exists(path);
+	// A file with a write held back by a budget will exist once it's written
+	if (deferredBytes > 0 && xSemaphoreTake(deferMutex, portMAX_DELAY) == pdTRUE) {
+		bool deferred = deferredWrites.count(path) > 0;
+		xSemaphoreGive(deferMutex);
+		if (deferred) {
+			return true;
+		}
+	}
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdTRUE) {
+		auto cached = existsCache.find(path);
+		if (cached != existsCache.end()) {
+			bool exists = cached->second.exists;
+			xSemaphoreGive(cacheMutex);
+			return exists;
+		}
+		xSemaphoreGive(cacheMutex);
+	}
+	LOG_TRACE(storageLog, "Checking for file: %s", path.c_str());
+	bool exists = tierFor(path).fs->exists(path);
+	cacheExists(path, exists);
+	return exists;
 }
 
 /// @brief Creates a directory on the storage
 /// @param path The path of the directory to create
 /// @return True on success
 bool Storage::createDir(String path) {
-	Logger.println("Creating Dir: " + path);
-	return storageSystem->mkdir(path);;
+	LOG_DEBUG(storageLog, "Creating dir: %s", path.c_str());
+	bool success = tierFor(path).fs->mkdir(path);
+	if (success) {
+		cacheExists(path, true);
+	}
+	return success;
 }
 
 /// @brief Removes a directory from the storage
 /// @param path The path of the directory to remove
 /// @return True on success
 bool Storage::removeDir(String path) {
-	Logger.println("Removing Dir:" + path);
-	return storageSystem->rmdir(path);
+	LOG_DEBUG(storageLog, "Removing dir: %s", path.c_str());
+	bool success = tierFor(path).fs->rmdir(path);
+	if (success) {
+		cacheExists(path, false);
+	}
+	return success;
 }
 
-/// @brief Reads the contents of a file from the storage
+/// @brief Reads the contents of a file from the storage. For large files use one of the streaming overloads
 /// @param path The path of the file to read
 /// @return A String of the file contents, empty string on failure
 String Storage::readFile(String path) {
-	Logger.println("Reading file: " + path);
-	File file = storageSystem->open(path);
+	// Writes held back by a budget are part of the contents
+	if (xSemaphoreTake(deferMutex, portMAX_DELAY) == pdTRUE) {
+		auto deferred = deferredWrites.find(path);
+		if (deferred != deferredWrites.end()) {
+			DeferredWrite write = deferred->second;
+			xSemaphoreGive(deferMutex);
+			if (write.mode == WriteMode::Append) {
+				File file = tierFor(path).fs->open(path);
+				String output = file ? file.readString() : "";
+				return output + write.content;
+			}
+			return write.content;
+		}
+		xSemaphoreGive(deferMutex);
+	}
+	bool cacheable = tierFor(path).cacheReads;
+	if (cacheable && xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdTRUE) {
+		auto cached = readCache.find(path);
+		if (cached != readCache.end()) {
+			String contents = cached->second;
+			xSemaphoreGive(cacheMutex);
+			return contents;
+		}
+		xSemaphoreGive(cacheMutex);
+	}
+	LOG_DEBUG(storageLog, "Reading file: %s", path.c_str());
+	File file = tierFor(path).fs->open(path);
 	if (!file) {
-		Logger.println("Failed to open file for reading");
+		LOG_WARN(storageLog, "Failed to open file for reading: %s", path.c_str());
 		return "";
 	}
-	String output = "";
-	while(file.available()){
-		output += file.readString();
+	// Size the string once and read straight into it in chunks
+	String output;
+	if (!output.reserve(file.size())) {
+		LOG_ERROR(storageLog, "Not enough memory to read %s", path.c_str());
+		file.close();
+		return "";
+	}
+	uint8_t buffer[chunkSize];
+	size_t count;
+	while ((count = file.read(buffer, chunkSize)) > 0) {
+		output.concat(reinterpret_cast<const char*>(buffer), count);
 	}
 	file.close();
+	if (cacheable && output.length() <= readCacheMaxFile && xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdTRUE) {
+		if (readCacheUsed + output.length() > readCacheSize) {
+			readCache.clear();
+			readCacheUsed = 0;
+		}
+		auto cached = readCache.find(path);
+		if (cached != readCache.end()) {
+			readCacheUsed -= cached->second.length();
+		}
+		readCache[path] = output;
+		readCacheUsed += output.length();
+		xSemaphoreGive(cacheMutex);
+	}
 	return output;
 }
 
+/// @brief Reads part of a file into a caller supplied buffer
+/// @param path The path of the file to read
+/// @param buffer The buffer to read into
+/// @param size The maximum number of bytes to read
+/// @param offset The position in the file to start reading from
+/// @return The number of bytes read, 0 on failure or at the end of the file
+size_t Storage::readFile(String path, uint8_t* buffer, size_t size, size_t offset) {
+	File file = tierFor(path).fs->open(path);
+	if (!file) {
+		LOG_WARN(storageLog, "Failed to open file for reading: %s", path.c_str());
+		return 0;
+	}
+	size_t count = 0;
+	if (file.seek(offset)) {
+		count = file.read(buffer, size);
+	}
+	file.close();
+	return count;
+}
+
+/// @brief Streams the contents of a file to any Print (e.g. Serial, a response stream, or another file) using constant memory
+/// @param path The path of the file to read
+/// @param output Where to write the contents
+/// @return True on success
+bool Storage::readFile(String path, Print& output) {
+	LOG_DEBUG(storageLog, "Streaming file: %s", path.c_str());
+	File file = tierFor(path).fs->open(path);
+	if (!file) {
+		LOG_WARN(storageLog, "Failed to open file for reading: %s", path.c_str());
+		return false;
+	}
+	uint8_t buffer[chunkSize];
+	size_t count;
+	bool success = true;
+	while (success && (count = file.read(buffer, chunkSize)) > 0) {
+		success = output.write(buffer, count) == count;
+	}
+	file.close();
+	return success;
+}
+
+/// @brief Calls a function for each line of a file, reading it in chunks. Line endings are removed
+/// @param path The path of the file to read
+/// @param callback The function to call with each line, return false to stop early
+/// @return True if the file was read to the end, or the callback stopped early
+bool Storage::forEachLine(String path, std::function<bool(const String&)> callback) {
+	File file = tierFor(path).fs->open(path);
+	if (!file) {
+		LOG_WARN(storageLog, "Failed to open file for reading: %s", path.c_str());
+		return false;
+	}
+	uint8_t buffer[chunkSize];
+	size_t count;
+	// The line is reused so its memory is only allocated once for the longest line
+	String line;
+	bool reading = true;
+	while (reading && (count = file.read(buffer, chunkSize)) > 0) {
+		for (size_t i = 0; i < count && reading; i++) {
+			if (buffer[i] == '\n') {
+				if (line.endsWith("\r")) {
+					line.remove(line.length() - 1);
+				}
+				reading = callback(line);
+				line.clear();
+			} else {
+				line += static_cast<char>(buffer[i]);
+			}
+		}
+	}
+	// Handle a last line with no line ending
+	if (reading && line.length() > 0) {
+		callback(line);
+	}
+	file.close();
+	return true;
+}
+
+/// @brief Opens a file for streaming. The file is a Stream, so it can be read from or printed to directly (e.g. with serializeJson)
+/// @param path The path of the file to open
+/// @param mode The mode to open the file in (FILE_READ, FILE_WRITE, or FILE_APPEND). Count bytes written through the file with consumeSpace
+/// @return The open file, which evaluates to false on failure. Close it when done
+File Storage::openFile(String path, const char* mode) {
+	LOG_DEBUG(storageLog, "Opening file: %s", path.c_str());
+	bool writing = strcmp(mode, FILE_READ) != 0;
+	// Opening for writing truncates the file, freeing its old contents
+	size_t oldSize = strcmp(mode, FILE_WRITE) == 0 ? sizeOf(path) : 0;
+	File file = tierFor(path).fs->open(path, mode, writing);
+	if (file && writing) {
+		cacheExists(path, true);
+		releaseSpace(path, oldSize);
+	}
+	return file;
+}
+
 /// @brief Writes data to a file, creates or overwrites a file if necessary
 /// @param path The path of the file to write
 /// @param content The content of the file to write
 /// @return True on success
 bool Storage::writeFile(String path, String content) {
-	Logger.println("Writing file: " + path);
-	if (content.length() >= freeSpace()) {
-		Logger.println("Not enough free space");
+	return writeFile(path, reinterpret_cast<const uint8_t*>(content.c_str()), content.length());
+}
+
+/// @brief Writes a buffer to a file, creates or overwrites a file if necessary. Held back and merged with later writes if the path is over its write budget
+/// @param path The path of the file to write
+/// @param buffer The data to write
+/// @param size The size of the data in bytes
+/// @return True on success
+bool Storage::writeFile(String path, const uint8_t* buffer, size_t size) {
+	if (deferWrite(path, buffer, size, WriteMode::Write)) {
+		return true;
+	}
+	return writeNow(path, buffer, size);
+}
+
+/// @brief Writes a buffer to a file now
+/// @param path The path of the file to write
+/// @param buffer The data to write
+/// @param size The size of the data in bytes
+/// @return True on success
+bool Storage::writeNow(String path, const uint8_t* buffer, size_t size) {
+	LOG_DEBUG(storageLog, "Writing file: %s", path.c_str());
+	if (size >= freeSpace(path)) {
+		LOG_ERROR(storageLog, "Not enough free space for %s", path.c_str());
 		return false;
 	}
-	File file = storageSystem->open(path, FILE_WRITE);
+	size_t oldSize = sizeOf(path);
+	File file = tierFor(path).fs->open(path, FILE_WRITE);
 	if (!file) {
-		Logger.println("Failed to open file for writing");
+		LOG_ERROR(storageLog, "Failed to open file for writing: %s", path.c_str());
 		return false;
 	}
-	return file.print(content) > 0;
+	bool success = file.write(buffer, size) == size;
+	file.close();
+	cacheExists(path, true);
+	// The new contents replace the old ones
+	releaseSpace(path, oldSize);
+	consumeSpace(path, size);
+	if (success) {
+		cacheSize(path, size);
+	}
+	return success;
 }
 
 /// @brief Appends data to a file
@@ -251,17 +540,256 @@ bool Storage::writeFile(String path, String content) {
 /// @param content The content to append
 /// @return True on success
 bool Storage::appendToFile(String path, String content) {
-	Logger.println("Appending to file: " + path);
-	File file = storageSystem->open(path, FILE_APPEND);
+	return appendToFile(path, reinterpret_cast<const uint8_t*>(content.c_str()), content.length());
+}
+
+/// @brief Appends a buffer to a file. Held back and merged with later appends if the path is over its write budget
+/// @param path The path of the file to append
+/// @param buffer The data to append
+/// @param size The size of the data in bytes
+/// @return True on success
+bool Storage::appendToFile(String path, const uint8_t* buffer, size_t size) {
+	if (deferWrite(path, buffer, size, WriteMode::Append)) {
+		return true;
+	}
+	return appendNow(path, buffer, size);
+}
+
+/// @brief Appends a buffer to a file now
+/// @param path The path of the file to append
+/// @param buffer The data to append
+/// @param size The size of the data in bytes
+/// @return True on success
+bool Storage::appendNow(String path, const uint8_t* buffer, size_t size) {
+	LOG_DEBUG(storageLog, "Appending to file: %s", path.c_str());
+	File file = tierFor(path).fs->open(path, FILE_APPEND);
+	if (!file) {
+		LOG_ERROR(storageLog, "Failed to open file for appending: %s", path.c_str());
+		return false;
+	}
+	size_t oldSize = file.size();
+	if (size + oldSize >= freeSpace(path)) {
+		LOG_ERROR(storageLog, "Not enough free space for %s", path.c_str());
+		file.close();
+		return false;
+	}
+	bool success = file.write(buffer, size) == size;
+	file.close();
+	cacheExists(path, true);
+	consumeSpace(path, size);
+	if (success) {
+		cacheSize(path, oldSize + size);
+	}
+	return success;
+}
+
+/// @brief Writes a file so that a reset at any point leaves either the old or the new contents, never a partial file. The previous contents are kept as a backup
+/// @param path The path of the file to write
+/// @param content The content of the file to write
+/// @return True on success
+bool Storage::writeFileAtomic(String path, String content) {
+	return writeFileAtomic(path, reinterpret_cast<const uint8_t*>(content.c_str()), content.length());
+}
+
+/// @brief Writes a buffer to a file so that a reset at any point leaves either the old or the new contents, never a partial file. The previous contents are kept as a backup
+/// @param path The path of the file to write
+/// @param buffer The data to write
+/// @param size The size of the data in bytes
+/// @return True on success
+bool Storage::writeFileAtomic(String path, const uint8_t* buffer, size_t size) {
+	return writeFileAtomic(path, size, [buffer, size](Print& file) {
+		return file.write(buffer, size) == size;
+	});
+}
+
+/// @brief Atomically writes a file using a function that prints the contents, e.g. to serialize straight to the file. The contents go to a temporary file that's read back and checked before it replaces the original, which is kept as a backup. Never held back by write budgets, since callers rely on the contents being on the media once this returns
+/// @param path The path of the file to write
+/// @param size The size of the contents in bytes, used to check for free space
+/// @param writer Function that prints the contents to the file it's given, returning true on success
+/// @return True on success
+bool Storage::writeFileAtomic(String path, size_t size, std::function<bool(Print&)> writer) {
+	// Keeps recoverFile on other tasks from taking the write in progress for an interrupted one
+	holdPath(path);
+	bool success = writeAtomic(path, size, writer);
+	releasePath(path);
+	return success;
+}
+
+/// @brief Makes an atomic write, see writeFileAtomic
+/// @param path The path of the file to write
+/// @param size The size of the contents in bytes, used to check for free space
+/// @param writer Function that prints the contents to the file it's given, returning true on success
+/// @return True on success
+bool Storage::writeAtomic(const String& path, size_t size, std::function<bool(Print&)> writer) {
+	LOG_DEBUG(storageLog, "Atomically writing file: %s", path.c_str());
+	// The new contents replace anything held back for the path, which would otherwise land on top of them later
+	dropDeferred(path);
+	// The old file and its backup both stay until the commit, so all of the new contents need to fit
+	if (size >= freeSpace(path)) {
+		LOG_ERROR(storageLog, "Not enough free space for %s", path.c_str());
+		return false;
+	}
+	String temp = path + tempSuffix;
+	String backup = path + backupSuffix;
+	File file = tierFor(temp).fs->open(temp, FILE_WRITE);
 	if (!file) {
-		Logger.println("Failed to open file for appending");
+		LOG_ERROR(storageLog, "Failed to open file for writing: %s", temp.c_str());
+		return false;
+	}
+	cacheExists(temp, true);
+	// Checksum the contents on the way out so they can be verified once written
+	class ChecksumPrint : public Print {
+		public:
+			ChecksumPrint(File& File) : file(File) {}
+			size_t write(uint8_t c) override {
+				return write(&c, 1);
+			}
+			size_t write(const uint8_t* buffer, size_t size) override {
+				size_t written = file.write(buffer, size);
+				checksum = esp_rom_crc32_le(checksum, buffer, written);
+				length += written;
+				return written;
+			}
+			File& file;
+			uint32_t checksum = 0;
+			size_t length = 0;
+	} output(file);
+	bool success = writer(output);
+	file.close();
+	consumeSpace(temp, output.length);
+	cacheSize(temp, output.length);
+	// Read back what landed on the media before trusting it
+	uint32_t checksum;
+	size_t length;
+	if (!success || !checksumFile(temp, checksum, length) || checksum != output.checksum || length != output.length) {
+		LOG_ERROR(storageLog, "Failed to verify %s, original left in place", path.c_str());
+		deleteFile(temp);
+		return false;
+	}
+	// Commit: keep the current version as the backup, then move the new file into place
+	if (fileExists(backup)) {
+		deleteFile(backup);
+	}
+	if (fileExists(path) && !renameFile(path, backup)) {
+		LOG_ERROR(storageLog, "Failed to back up %s", path.c_str());
+		deleteFile(temp);
 		return false;
 	}
-	if (content.length() + file.size() >= freeSpace()) {
-		Logger.println("Not enough free space");
+	if (!renameFile(temp, path)) {
+		LOG_ERROR(storageLog, "Failed to commit %s, restoring backup", path.c_str());
+		restoreBackup(path);
 		return false;
 	}
-	return file.print(content) > 0;
+	return true;
+}
+
+/// @brief Finishes or rolls back an atomic write interrupted by a reset. Call before reading a file written with writeFileAtomic. Waits for an atomic write of the file that's queued or running to finish first
+/// @param path The path of the file
+/// @return True if the file exists afterwards
+bool Storage::recoverFile(String path) {
+	for (uint32_t waited = 0; isHeld(path); waited += 10) {
+		if (waited >= recoverWait) {
+			// Its temporary file and backup belong to the write, leave them alone
+			LOG_WARN(storageLog, "%s is still being written, not recovering it", path.c_str());
+			return fileExists(path);
+		}
+		delay(10);
+	}
+	String temp = path + tempSuffix;
+	// A leftover temporary file was never verified, so it's discarded
+	if (fileExists(temp)) {
+		LOG_WARN(storageLog, "Discarding incomplete write of %s", path.c_str());
+		deleteFile(temp);
+	}
+	// The reset came between moving the old file to the backup and committing the new one
+	if (!fileExists(path) && fileExists(path + backupSuffix)) {
+		return restoreBackup(path);
+	}
+	return fileExists(path);
+}
+
+/// @brief Replaces a file with the backup kept by the last atomic write, e.g. when its contents can't be parsed
+/// @param path The path of the file
+/// @return True on success
+bool Storage::restoreBackup(String path) {
+	String backup = path + backupSuffix;
+	if (!fileExists(backup)) {
+		return false;
+	}
+	LOG_WARN(storageLog, "Restoring backup of %s", path.c_str());
+	if (fileExists(path) && !deleteFile(path)) {
+		return false;
+	}
+	return renameFile(backup, path);
+}
+
+/// @brief Marks a path as having an atomic write queued or running, so recoverFile waits for it rather than discarding its temporary file. Each call needs a matching releasePath
+/// @param path The path of the file
+void Storage::holdPath(String path) {
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdTRUE) {
+		heldPaths[path]++;
+		xSemaphoreGive(cacheMutex);
+	}
+}
+
+/// @brief Ends a hold taken with holdPath
+/// @param path The path of the file
+void Storage::releasePath(String path) {
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdTRUE) {
+		auto held = heldPaths.find(path);
+		if (held != heldPaths.end() && --held->second == 0) {
+			heldPaths.erase(held);
+		}
+		xSemaphoreGive(cacheMutex);
+	}
+}
+
+/// @brief Checks if a path has an atomic write queued or running
+/// @param path The path of the file
+/// @return True if held
+bool Storage::isHeld(const String& path) {
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdFALSE) {
+		return false;
+	}
+	bool held = heldPaths.count(path) > 0;
+	xSemaphoreGive(cacheMutex);
+	return held;
+}
+
+/// @brief Computes the CRC-32 of a file's contents
+/// @param path The path of the file
+/// @param checksum Set to the checksum
+/// @param size Set to the size of the file in bytes
+/// @return True on success
+bool Storage::checksumFile(String path, uint32_t& checksum, size_t& size) {
+	File file = tierFor(path).fs->open(path);
+	if (!file) {
+		return false;
+	}
+	checksum = 0;
+	size = 0;
+	uint8_t buffer[chunkSize];
+	size_t count;
+	while ((count = file.read(buffer, chunkSize)) > 0) {
+		checksum = esp_rom_crc32_le(checksum, buffer, count);
+		size += count;
+	}
+	file.close();
+	return true;
+}
+
+/// @brief Creates any missing directories containing a file
+/// @param path The full path of the file
+/// @return True on success
+bool Storage::createParentDirs(String path) {
+	int pos = 0;
+	while ((pos = path.indexOf('/', pos + 1)) > 0) {
+		String dir = path.substring(0, pos);
+		if (!fileExists(dir) && !createDir(dir)) {
+			return false;
+		}
+	}
+	return true;
 }
 
 /// @brief Renames/moves a file on the storage
@@ -269,34 +797,364 @@ bool Storage::appendToFile(String path, String content) {
 /// @param path2 The new path/name of the file
 /// @return True on success
 bool Storage::renameFile(String path1, String path2) {
-	Logger.println("Renaming file" + path1 + " to " + path2);
-	return storageSystem->rename(path1, path2);
+	LOG_DEBUG(storageLog, "Renaming file %s to %s", path1.c_str(), path2.c_str());
+	size_t size = sizeOf(path1);
+	// A file already at the new path is replaced
+	size_t replaced = sizeOf(path2);
+	bool success;
+	bool moved = tierFor(path1).fs != tierFor(path2).fs;
+	if (!moved) {
+		success = tierFor(path1).fs->rename(path1, path2);
+	} else {
+		// Moving between media needs a copy
+		success = copyFile(path1, path2) && tierFor(path1).fs->remove(path1);
+	}
+	if (success) {
+		cacheExists(path1, false);
+		cacheExists(path2, true);
+		releaseSpace(path2, replaced);
+		if (moved) {
+			releaseSpace(path1, size);
+			consumeSpace(path2, size);
+		} else {
+			recordWrite(path2, 0);
+		}
+		cacheSize(path2, size);
+	}
+	return success;
 }
 
 /// @brief Deletes a file from the storage
 /// @param path The path of the file to delete
 /// @return True on success
 bool Storage::deleteFile(String path) {
-	Logger.println("Deleting file: " + path);
-	return storageSystem->remove(path);
+	LOG_DEBUG(storageLog, "Deleting file: %s", path.c_str());
+	size_t size = sizeOf(path);
+	bool success = tierFor(path).fs->remove(path);
+	if (success) {
+		cacheExists(path, false);
+		releaseSpace(path, size);
+		recordWrite(path, 0);
+	}
+	return success;
 }
 
-/// @brief Get free space on filesystem
+/// @brief Get free space on the primary media. Uses a counter kept up to date by writes and deletes, only checked against the media occasionally to correct drift
 /// @return The number of free bytes
 size_t Storage::freeSpace() {
-	switch (storageMedia)
+	return freeSpace("");
+}
+
+/// @brief Get free space on the media a path is stored on. Uses a counter kept up to date by writes and deletes, only checked against the media occasionally to correct drift
+/// @param path The path
+/// @return The number of free bytes
+size_t Storage::freeSpace(String path) {
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdFALSE) {
+		return 0;
+	}
+	Tier& tier = tierFor(path);
+	if (!tier.spaceValid || millis() - tier.spaceCheckedAt >= spaceReconcileInterval) {
+		querySpace(tier);
+	}
+	size_t free = tier.totalBytes > tier.usedBytes ? tier.totalBytes - tier.usedBytes : 0;
+	xSemaphoreGive(cacheMutex);
+	return free;
+}
+
+/// @brief Counts bytes written outside of Storage's own write functions (e.g. through an open file) against the free space and the media's wear
+/// @param path The path written to
+/// @param bytes The number of bytes written
+void Storage::consumeSpace(String path, size_t bytes) {
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdTRUE) {
+		tierFor(path).usedBytes += bytes;
+		xSemaphoreGive(cacheMutex);
+	}
+	recordWrite(path, bytes);
+}
+
+/// @brief Counts bytes written outside of Storage's own write functions against the media's wear, for writes that don't use more space (e.g. rewriting part of a file in place)
+/// @param path The path written to
+/// @param bytes The number of bytes written
+void Storage::recordWrite(String path, size_t bytes) {
+	StorageWear::record(path, bytes, tierFor(path).media == Storage::Media::LittleFS);
+}
+
+/// @brief Makes writes held back by write budgets once their paths are within budget again. Call regularly, e.g. from the main loop
+/// @param force True to make all held writes now, e.g. before a reboot
+void Storage::flushDeferred(bool force) {
+	if (deferredBytes == 0 || xSemaphoreTake(deferMutex, portMAX_DELAY) == pdFALSE) {
+		return;
+	}
+	std::vector<std::pair<String, DeferredWrite>> due;
+	for (auto write = deferredWrites.begin(); write != deferredWrites.end();) {
+		if (force || StorageWear::withinBudget(write->first, write->second.content.length())) {
+			deferredBytes -= write->second.content.length();
+			due.push_back(*write);
+			write = deferredWrites.erase(write);
+		} else {
+			write++;
+		}
+	}
+	xSemaphoreGive(deferMutex);
+	for (const auto& write : due) {
+		const uint8_t* buffer = reinterpret_cast<const uint8_t*>(write.second.content.c_str());
+		size_t size = write.second.content.length();
+		bool success;
+		if (write.second.mode == WriteMode::Append) {
+			success = appendNow(write.first, buffer, size);
+		} else {
+			success = writeNow(write.first, buffer, size);
+		}
+		if (!success) {
+			LOG_ERROR(storageLog, "Failed to write held back changes to %s", write.first.c_str());
+		}
+	}
+}
+
+/// @brief Holds back a write if its path is over its write budget, merging it with any write already held back for the path so only the final result reaches the media
+/// @param path The path to write
+/// @param buffer The data to write
+/// @param size The size of the data in bytes
+/// @param mode How the data is written
+/// @return True if held back, false if the write should be made now
+bool Storage::deferWrite(const String& path, const uint8_t* buffer, size_t size, WriteMode mode) {
+	if (xSemaphoreTake(deferMutex, portMAX_DELAY) == pdFALSE) {
+		return false;
+	}
+	auto pending = deferredWrites.find(path);
+	// A write already held back for the path must be merged with, or it'd land out of order
+	if (pending == deferredWrites.end() && (StorageWear::withinBudget(path, size) || deferredBytes + size > maxDeferredBytes)) {
+		xSemaphoreGive(deferMutex);
+		return false;
+	}
+	if (pending == deferredWrites.end()) {
+		LOG_DEBUG(storageLog, "Over write budget, holding back write to %s", path.c_str());
+		pending = deferredWrites.emplace(path, DeferredWrite { "", mode }).first;
+	}
+	DeferredWrite& write = pending->second;
+	deferredBytes -= write.content.length();
+	if (mode == WriteMode::Append) {
+		// Appends add to whatever is held, a held whole-file write stays a whole-file write
+		write.content.concat(reinterpret_cast<const char*>(buffer), size);
+	} else {
+		// A whole-file write replaces anything held
+		write.content = "";
+		write.content.concat(reinterpret_cast<const char*>(buffer), size);
+		write.mode = mode;
+	}
+	deferredBytes += write.content.length();
+	xSemaphoreGive(deferMutex);
+	return true;
+}
+
+/// @brief Discards any write held back for a path, used when the whole file is about to be replaced
+/// @param path The path
+void Storage::dropDeferred(const String& path) {
+	if (deferredBytes == 0 || xSemaphoreTake(deferMutex, portMAX_DELAY) == pdFALSE) {
+		return;
+	}
+	auto pending = deferredWrites.find(path);
+	if (pending != deferredWrites.end()) {
+		deferredBytes -= pending->second.content.length();
+		deferredWrites.erase(pending);
+	}
+	xSemaphoreGive(deferMutex);
+}
+
+/// @brief Drops all cached metadata, it's refreshed from the media when next needed. Call after changing files through the file system directly
+void Storage::invalidateCache() {
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdTRUE) {
+		primary.spaceValid = false;
+		for (auto& tier : tiers) {
+			tier.spaceValid = false;
+		}
+		existsCache.clear();
+		listCache.clear();
+		readCache.clear();
+		readCacheUsed = 0;
+		xSemaphoreGive(cacheMutex);
+	}
+}
+
+/// @brief Takes bytes freed by replacing or removing a file off the used space counter of its media
+/// @param path The path of the file
+/// @param bytes The number of bytes freed
+void Storage::releaseSpace(const String& path, size_t bytes) {
+	if (bytes > 0 && xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdTRUE) {
+		Tier& tier = tierFor(path);
+		tier.usedBytes -= std::min(bytes, tier.usedBytes);
+		xSemaphoreGive(cacheMutex);
+	}
+}
+
+/// @brief Gets the size of a file, from the cache if it's known
+/// @param path The path of the file
+/// @return The size in bytes, 0 if the file doesn't exist
+size_t Storage::sizeOf(const String& path) {
+	if (!fileExists(path)) {
+		return 0;
+	}
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdTRUE) {
+		auto cached = existsCache.find(path);
+		if (cached != existsCache.end() && cached->second.sized) {
+			size_t size = cached->second.size;
+			xSemaphoreGive(cacheMutex);
+			return size;
+		}
+		xSemaphoreGive(cacheMutex);
+	}
+	File file = tierFor(path).fs->open(path);
+	if (!file) {
+		return 0;
+	}
+	size_t size = file.isDirectory() ? 0 : file.size();
+	file.close();
+	cacheSize(path, size);
+	return size;
+}
+
+/// @brief Records the size of a file that exists, after it's been written or measured
+/// @param path The path of the file
+/// @param size The size in bytes
+void Storage::cacheSize(const String& path, size_t size) {
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdTRUE) {
+		auto cached = existsCache.find(path);
+		if (cached != existsCache.end() && cached->second.exists) {
+			cached->second.sized = true;
+			cached->second.size = size;
+		} else if (cached == existsCache.end() && existsCache.size() < maxCacheEntries) {
+			existsCache[path] = PathInfo { true, true, size };
+		}
+		xSemaphoreGive(cacheMutex);
+	}
+}
+
+/// @brief Looks up a cached directory listing
+/// @param key The listing type, depth, and path
+/// @param list Filled with the listing if found
+/// @return True if found
+bool Storage::cachedList(const String& key, std::vector<String>& list) {
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdFALSE) {
+		return false;
+	}
+	auto cached = listCache.find(key);
+	bool found = cached != listCache.end();
+	if (found) {
+		list = cached->second;
+	}
+	xSemaphoreGive(cacheMutex);
+	return found;
+}
+
+/// @brief Caches a directory listing
+/// @param key The listing type, depth, and path
+/// @param list The listing
+void Storage::cacheList(const String& key, const std::vector<String>& list) {
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdTRUE) {
+		if (listCache.size() >= maxCacheEntries) {
+			listCache.clear();
+		}
+		listCache[key] = list;
+		xSemaphoreGive(cacheMutex);
+	}
+}
+
+/// @brief Records whether a path exists, after it's been created, written, or removed. Any change to which paths exist also drops the cached listings
+/// @param path The path
+/// @param exists True if it exists
+void Storage::cacheExists(const String& path, bool exists) {
+	if (xSemaphoreTake(cacheMutex, portMAX_DELAY) == pdTRUE) {
+		// The contents changed, so a cached copy is out of date
+		auto read = readCache.find(path);
+		if (read != readCache.end()) {
+			readCacheUsed -= read->second.length();
+			readCache.erase(read);
+		}
+		auto cached = existsCache.find(path);
+		if (cached == existsCache.end() || cached->second.exists != exists) {
+			if (!exists) {
+				// Removing a directory removes everything in it, so forget what's known about its contents
+				String prefix = path + "/";
+				for (auto entry = existsCache.begin(); entry != existsCache.end();) {
+					entry = entry->first.startsWith(prefix) ? existsCache.erase(entry) : std::next(entry);
+				}
+			}
+			if (existsCache.size() >= maxCacheEntries) {
+				existsCache.clear();
+			}
+			listCache.clear();
+		}
+		// The size changes with the contents, it's measured again when needed. A removed path has none
+		existsCache[path] = PathInfo { exists, !exists, 0 };
+		xSemaphoreGive(cacheMutex);
+	}
+}
+
+/// @brief Gets the tier a path is stored on
+/// @param path The path
+/// @return The tier with the longest matching prefix, or the primary tier
+Storage::Tier& Storage::tierFor(const String& path) {
+	for (auto& tier : tiers) {
+		if (path.startsWith(tier.prefix) && (path.length() == tier.prefix.length() || path[tier.prefix.length()] == '/' || tier.prefix.endsWith("/"))) {
+			return tier;
+		}
+	}
+	return primary;
+}
+
+/// @brief Reads a tier's space counters from the media. Must hold the cache mutex
+/// @param tier The tier
+void Storage::querySpace(Tier& tier) {
+	switch (tier.media)
 	{
 		case Storage::Media::LittleFS:
-			return LittleFS.totalBytes() - LittleFS.usedBytes();
+			tier.totalBytes = LittleFS.totalBytes();
+			tier.usedBytes = LittleFS.usedBytes();
 			break;
 		case Storage::Media::SD_SPI:
-			return SD.totalBytes() - SD.usedBytes();
+			tier.totalBytes = SD.totalBytes();
+			tier.usedBytes = SD.usedBytes();
 			break;
 		#ifdef SOC_SDMMC_HOST_SUPPORTED
 		case Storage::Media::SD_MMC:
-			return SD_MMC.totalBytes() - SD_MMC.usedBytes();
+			tier.totalBytes = SD_MMC.totalBytes();
+			tier.usedBytes = SD_MMC.usedBytes();
 			break;
 		#endif
+		default:
+			tier.totalBytes = 0;
+			tier.usedBytes = 0;
+			break;
+	}
+	tier.spaceValid = true;
+	tier.spaceCheckedAt = millis();
+}
+
+/// @brief Copies a file, e.g. to move it between media
+/// @param from The path of the file to copy
+/// @param to The path of the copy
+/// @return True on success
+bool Storage::copyFile(String from, String to) {
+	File source = tierFor(from).fs->open(from);
+	if (!source) {
+		return false;
 	}
-	return 0;
+	if (source.size() >= freeSpace(to)) {
+		source.close();
+		return false;
+	}
+	File destination = tierFor(to).fs->open(to, FILE_WRITE, true);
+	if (!destination) {
+		source.close();
+		return false;
+	}
+	uint8_t buffer[chunkSize];
+	size_t count;
+	bool success = true;
+	while (success && (count = source.read(buffer, chunkSize)) > 0) {
+		success = destination.write(buffer, count) == count;
+	}
+	source.close();
+	destination.close();
+	return success;
 }
\ No newline at end of file
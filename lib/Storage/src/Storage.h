@@ -8,11 +8,16 @@
 
 #pragma once
 #include <LogBroadcaster.h>
+#include <StorageWear.h>
 #include <FS.h>
 #include <SD_MMC.h>
 #include <LittleFS.h>
 #include <SPI.h>
 #include <SD.h>
+#include <esp_rom_crc.h>
+#include <algorithm>
+#include <functional>
+#include <map>
 #include <vector>
 
 /// @brief Provides standardized access to various storage media
@@ -30,7 +35,9 @@ class Storage {
 		static bool begin();
 		static bool begin(int sdi, int sdo, int sck, int cs, uint32_t frequency = 4000000, SPIClass &spi = SPI);
 		static bool begin(int clk, int cmd, int d0, int d1, int d2, int d3, uint32_t frequency = 40000);
+		static bool addTier(String prefix, Media media, bool cacheReads = false);
 		static FS* getFileSystem();
+		static FS* getFileSystem(String path);
 		static Storage::Media getMediaType();
 		static std::vector<String> listFiles(String dirname, uint8_t levels);
 		static std::vector<String> listDirs(String dirname, uint8_t levels);
@@ -38,16 +45,160 @@ class Storage {
 		static bool createDir(String path);
 		static bool removeDir(String path);
 		static String readFile(String path);
+		static size_t readFile(String path, uint8_t* buffer, size_t size, size_t offset = 0);
+		static bool readFile(String path, Print& output);
+		static bool forEachLine(String path, std::function<bool(const String&)> callback);
+		static File openFile(String path, const char* mode = FILE_READ);
 		static bool writeFile(String path, String content);
+		static bool writeFile(String path, const uint8_t* buffer, size_t size);
 		static bool appendToFile(String path, String content);
+		static bool appendToFile(String path, const uint8_t* buffer, size_t size);
+		static bool writeFileAtomic(String path, String content);
+		static bool writeFileAtomic(String path, const uint8_t* buffer, size_t size);
+		static bool writeFileAtomic(String path, size_t size, std::function<bool(Print&)> writer);
+		static bool recoverFile(String path);
+		static void holdPath(String path);
+		static void releasePath(String path);
+		static bool restoreBackup(String path);
+		static bool createParentDirs(String path);
+		static void consumeSpace(String path, size_t bytes);
+		static void recordWrite(String path, size_t bytes);
+		static void flushDeferred(bool force = false);
+		static void invalidateCache();
 		static bool renameFile(String path1, String path2);
 		static bool deleteFile(String path);
 		static size_t freeSpace();
+		static size_t freeSpace(String path);
 		
 	private:
-		/// @brief The storage media type being used
-		static Media storageMedia;
+		/// @brief Size of the stack buffer used to move file data in chunks
+		static const size_t chunkSize = 512;
 
-		/// @brief The file system being used
-		static FS* storageSystem;	
+		/// @brief Suffix of the temporary file an atomic write goes to before it's committed
+		static constexpr const char* tempSuffix = ".tmp";
+
+		/// @brief Suffix of the previous version of a file kept by an atomic write
+		static constexpr const char* backupSuffix = ".bak";
+
+		/// @brief Longest time in ms recoverFile waits for an atomic write of the same file to finish
+		static const uint32_t recoverWait = 2000;
+
+		/// @brief Time in ms between checks of the free space counter against the media
+		static const uint32_t spaceReconcileInterval = 30000;
+
+		/// @brief Maximum number of entries in each metadata cache before it's cleared
+		static const size_t maxCacheEntries = 64;
+
+		/// @brief Most bytes held back by write budgets before writes go through regardless
+		static const size_t maxDeferredBytes = 16384;
+
+		/// @brief How a write held back by a budget is made once it's due. Atomic writes are never held back
+		enum class WriteMode { Write, Append };
+
+		/// @brief A write held back by a budget. Later writes to the same path are merged into it
+		struct DeferredWrite {
+			/// @brief The contents to write or append
+			String content;
+
+			/// @brief How to write the contents
+			WriteMode mode;
+		};
+
+		/// @brief Writes held back by budgets, by path
+		static std::map<String, DeferredWrite> deferredWrites;
+
+		/// @brief Bytes held in deferred writes
+		static size_t deferredBytes;
+
+		/// @brief Mutex protecting the deferred writes
+		static SemaphoreHandle_t deferMutex;
+
+		/// @brief Largest file kept in the read cache
+		static const size_t readCacheMaxFile = 4096;
+
+		/// @brief Most bytes held by the read cache before it's cleared
+		static const size_t readCacheSize = 16384;
+
+		/// @brief A mounted media and the paths stored on it
+		struct Tier {
+			/// @brief Paths starting with this are stored on the tier, empty for the primary media
+			String prefix;
+
+			/// @brief The media type
+			Media media;
+
+			/// @brief The file system on the media
+			FS* fs;
+
+			/// @brief True to keep small files read from the tier in memory
+			bool cacheReads;
+
+			/// @brief Total bytes on the media, cached
+			size_t totalBytes = 0;
+
+			/// @brief Used bytes on the media, cached and adjusted as files are written and removed
+			size_t usedBytes = 0;
+
+			/// @brief True when the cached space counters can be used
+			bool spaceValid = false;
+
+			/// @brief Time in ms the space counters were last read from the media
+			ulong spaceCheckedAt = 0;
+		};
+
+		/// @brief The media mounted by begin, stores every path not routed to another tier
+		static Tier primary;
+
+		/// @brief Additional media, longest prefix first
+		static std::vector<Tier> tiers;
+
+		/// @brief What's known about a path
+		struct PathInfo {
+			/// @brief True if the path exists
+			bool exists;
+
+			/// @brief True if the size is known
+			bool sized;
+
+			/// @brief Size of the file in bytes, used to adjust the space counters when it's replaced or removed
+			size_t size;
+		};
+
+		/// @brief Cached results of existence checks and file sizes by path
+		static std::map<String, PathInfo> existsCache;
+
+		/// @brief Cached directory listings by type, depth, and path
+		static std::map<String, std::vector<String>> listCache;
+
+		/// @brief Contents of small files read from tiers that cache reads
+		static std::map<String, String> readCache;
+
+		/// @brief Bytes held by the read cache
+		static size_t readCacheUsed;
+
+		/// @brief Paths with atomic writes queued or running, and how many
+		static std::map<String, uint8_t> heldPaths;
+
+		/// @brief Mutex protecting the caches and counters
+		static SemaphoreHandle_t cacheMutex;
+
+		static std::vector<String> scanFiles(String dirname, uint8_t levels);
+		static std::vector<String> scanDirs(String dirname, uint8_t levels);
+		static bool cachedList(const String& key, std::vector<String>& list);
+		static void cacheList(const String& key, const std::vector<String>& list);
+		static void cacheExists(const String& path, bool exists);
+		static Tier& tierFor(const String& path);
+		static void querySpace(Tier& tier);
+		static const char* cardTypeName(uint8_t type);
+		static void releaseSpace(const String& path, size_t bytes);
+		static size_t sizeOf(const String& path);
+		static void cacheSize(const String& path, size_t size);
+		static bool writeAtomic(const String& path, size_t size, std::function<bool(Print&)> writer);
+		static bool isHeld(const String& path);
+		static bool checksumFile(String path, uint32_t& checksum, size_t& size);
+		static bool copyFile(String from, String to);
+		static bool writeNow(String path, const uint8_t* buffer, size_t size);
+		static bool appendNow(String path, const uint8_t* buffer, size_t size);
+		static bool deferWrite(const String& path, const uint8_t* buffer, size_t size, WriteMode mode);
+		static void dropDeferred(const String& path);
 };
\ No newline at end of file
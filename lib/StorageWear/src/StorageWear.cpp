@@ -0,0 +1,179 @@
+#include "StorageWear.h"
+
+// Initialize static variables
+std::map<String, StorageWear::Usage> StorageWear::prefixes;
+std::map<String, StorageWear::Usage> StorageWear::tasks;
+uint64_t StorageWear::lifetimeErases = 0;
+uint64_t StorageWear::savedErases = 0;
+uint64_t StorageWear::bootErases = 0;
+size_t StorageWear::flashBlocks = 0;
+bool StorageWear::started = false;
+TaskHandle_t StorageWear::proxyTask = NULL;
+String StorageWear::proxyCaller;
+SemaphoreHandle_t StorageWear::wearMutex = xSemaphoreCreateMutex();
+
+/// @brief Loads the lifetime erase count. Only the first call has any effect, so erases counted since boot are kept when the internal flash is mounted again for another tier
+/// @param flashSize The size in bytes of the internal flash file system, 0 if it's not used
+/// @return True on success
+bool StorageWear::begin(size_t flashSize) {
+	if (started) {
+		return true;
+	}
+	started = true;
+	flashBlocks = flashSize / eraseBlockSize;
+	Preferences preferences;
+	if (!preferences.begin("storagewear", true)) {
+		// Nothing saved yet
+		return true;
+	}
+	lifetimeErases = preferences.getULong64("erases", 0);
+	savedErases = lifetimeErases;
+	preferences.end();
+	return true;
+}
+
+/// @brief Records a write
+/// @param path The path written to
+/// @param bytes The number of bytes written
+/// @param internal True if the path is on the internal flash
+void StorageWear::record(const String& path, size_t bytes, bool internal) {
+	if (xSemaphoreTake(wearMutex, portMAX_DELAY) == pdFALSE) {
+		return;
+	}
+	// Every write commits at least one block, larger writes one per block written
+	uint32_t erases = std::max<size_t>(1, (bytes + eraseBlockSize - 1) / eraseBlockSize);
+	String caller = xTaskGetCurrentTaskHandle() == proxyTask ? proxyCaller : String(pcTaskGetName(NULL));
+	for (Usage* usage : { &prefixes[prefixOf(path)], &tasks[caller] }) {
+		usage->bytes += bytes;
+		usage->writes++;
+		usage->erases += erases;
+	}
+	Usage& prefix = prefixes[prefixOf(path)];
+	if (millis() - prefix.windowStart >= budgetWindow) {
+		prefix.windowStart = millis();
+		prefix.windowBytes = 0;
+	}
+	prefix.windowBytes += bytes;
+	bool saveNow = false;
+	if (internal) {
+		lifetimeErases += erases;
+		bootErases += erases;
+		saveNow = lifetimeErases - savedErases >= saveEvery;
+	}
+	xSemaphoreGive(wearMutex);
+	if (saveNow) {
+		save();
+	}
+}
+
+/// @brief Checks if a write fits in the budget of its prefix
+/// @param path The path to write to
+/// @param bytes The number of bytes to write
+/// @return True if the write can go ahead
+bool StorageWear::withinBudget(const String& path, size_t bytes) {
+	if (xSemaphoreTake(wearMutex, portMAX_DELAY) == pdFALSE) {
+		return true;
+	}
+	bool within = true;
+	auto usage = prefixes.find(prefixOf(path));
+	if (usage != prefixes.end() && usage->second.budget > 0) {
+		if (millis() - usage->second.windowStart >= budgetWindow) {
+			usage->second.windowStart = millis();
+			usage->second.windowBytes = 0;
+		}
+		within = usage->second.windowBytes + bytes <= usage->second.budget;
+	}
+	xSemaphoreGive(wearMutex);
+	return within;
+}
+
+/// @brief Limits how much can be written to a prefix each hour. Writes over the budget are held back and coalesced by Storage
+/// @param prefix The top-level path prefix, e.g. "/data"
+/// @param bytesPerHour The bytes allowed per hour, 0 for no limit
+void StorageWear::setBudget(String prefix, size_t bytesPerHour) {
+	if (xSemaphoreTake(wearMutex, portMAX_DELAY) == pdTRUE) {
+		Usage& usage = prefixes[prefixOf(prefix)];
+		usage.budget = bytesPerHour;
+		usage.windowStart = millis();
+		usage.windowBytes = 0;
+		xSemaphoreGive(wearMutex);
+	}
+}
+
+/// @brief Attributes writes made by the calling task to another task until called again, used by tasks that write on behalf of others
+/// @param caller The name of the task being written for
+void StorageWear::attributeTo(const String& caller) {
+	if (xSemaphoreTake(wearMutex, portMAX_DELAY) == pdTRUE) {
+		proxyTask = xTaskGetCurrentTaskHandle();
+		proxyCaller = caller;
+		xSemaphoreGive(wearMutex);
+	}
+}
+
+/// @brief Saves the lifetime erase count, e.g. before a reboot
+void StorageWear::save() {
+	if (xSemaphoreTake(wearMutex, portMAX_DELAY) == pdFALSE) {
+		return;
+	}
+	uint64_t erases = lifetimeErases;
+	bool changed = erases != savedErases;
+	xSemaphoreGive(wearMutex);
+	if (!changed) {
+		return;
+	}
+	Preferences preferences;
+	if (preferences.begin("storagewear", false)) {
+		preferences.putULong64("erases", erases);
+		preferences.end();
+		savedErases = erases;
+	}
+}
+
+/// @brief Gets write totals and the estimated life of the internal flash
+/// @return A JSON string of the storage wear
+String StorageWear::getWear() {
+	JsonDocument doc;
+	if (xSemaphoreTake(wearMutex, portMAX_DELAY) == pdFALSE) {
+		return "{}";
+	}
+	uint64_t capacity = static_cast<uint64_t>(flashBlocks) * flashEndurance;
+	doc["lifetimeErases"] = lifetimeErases;
+	doc["eraseCapacity"] = capacity;
+	if (capacity > 0) {
+		doc["lifeUsed"] = static_cast<double>(lifetimeErases) / capacity * 100;
+		// Project the wear rate since boot over the erases left
+		double seconds = millis() / 1000.0;
+		if (bootErases > 0 && lifetimeErases < capacity) {
+			doc["yearsLeft"] = (capacity - lifetimeErases) / (bootErases / seconds) / 31536000.0;
+		}
+	}
+	for (const auto& list : { std::make_pair("prefixes", &prefixes), std::make_pair("tasks", &tasks) }) {
+		JsonObject object = doc[list.first].to<JsonObject>();
+		for (const auto& usage : *list.second) {
+			JsonObject entry = object[usage.first].to<JsonObject>();
+			entry["bytes"] = usage.second.bytes;
+			entry["writes"] = usage.second.writes;
+			entry["erases"] = usage.second.erases;
+			if (usage.second.budget > 0) {
+				entry["budget"] = usage.second.budget;
+				entry["windowBytes"] = usage.second.windowBytes;
+			}
+		}
+	}
+	xSemaphoreGive(wearMutex);
+	String output;
+	serializeJson(doc, output);
+	return output;
+}
+
+/// @brief Gets the top-level prefix of a path, writes are accounted by the directory they're under
+/// @param path The path
+/// @return The prefix, e.g. "/data" for "/data/log.csv", or "/" for files in the root
+String StorageWear::prefixOf(const String& path) {
+	int end = path.indexOf('/', 1);
+	if (end < 0) {
+		// A directory itself, or a file in the root
+		return path.indexOf('.') < 0 ? path : "/";
+	}
+	return path.substring(0, end);
+}
\ No newline at end of file
@@ -0,0 +1,92 @@
+/*
+* This file and associated .cpp file are licensed under the GPLv3 License Copyright (c) 2024 Sam Groveman
+*
+* External libraries needed:
+* ArduinoJSON: https://arduinojson.org/
+*
+* Contributors: Sam Groveman
+*/
+
+#pragma once
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include <map>
+
+/// @brief Accounts storage writes by path prefix and by calling task, enforces per-prefix write budgets, and estimates the remaining life of the internal flash
+class StorageWear {
+	public:
+		static bool begin(size_t flashSize);
+		static void record(const String& path, size_t bytes, bool internal);
+		static bool withinBudget(const String& path, size_t bytes);
+		static void setBudget(String prefix, size_t bytesPerHour);
+		static void attributeTo(const String& caller);
+		static void save();
+		static String getWear();
+
+	private:
+		/// @brief Size in bytes of a flash erase block
+		static const size_t eraseBlockSize = 4096;
+
+		/// @brief Rated erase cycles of each flash block
+		static const uint32_t flashEndurance = 100000;
+
+		/// @brief Length in ms of a budget window
+		static const uint32_t budgetWindow = 3600000;
+
+		/// @brief Erases between saves of the lifetime count, kept low so saving doesn't add noticeable wear of its own
+		static const uint32_t saveEvery = 1000;
+
+		/// @brief Write totals for a prefix or task
+		struct Usage {
+			/// @brief Bytes written
+			uint64_t bytes = 0;
+
+			/// @brief Write operations
+			uint32_t writes = 0;
+
+			/// @brief Estimated erase blocks used
+			uint32_t erases = 0;
+
+			/// @brief Bytes allowed per budget window, 0 for no limit
+			size_t budget = 0;
+
+			/// @brief Bytes written in the current budget window
+			size_t windowBytes = 0;
+
+			/// @brief Time in ms the current budget window started
+			ulong windowStart = 0;
+		};
+
+		/// @brief Usage by top-level path prefix
+		static std::map<String, Usage> prefixes;
+
+		/// @brief Usage by the name of the writing task
+		static std::map<String, Usage> tasks;
+
+		/// @brief Estimated internal flash erases over the life of the device
+		static uint64_t lifetimeErases;
+
+		/// @brief Lifetime erases when last saved
+		static uint64_t savedErases;
+
+		/// @brief Internal flash erases since boot
+		static uint64_t bootErases;
+
+		/// @brief Erase blocks in the internal flash file system
+		static size_t flashBlocks;
+
+		/// @brief True once begin has loaded the lifetime erase count
+		static bool started;
+
+		/// @brief Task writing on behalf of another, e.g. the storage worker
+		static TaskHandle_t proxyTask;
+
+		/// @brief Name of the task the proxy is writing for
+		static String proxyCaller;
+
+		/// @brief Mutex protecting the counters
+		static SemaphoreHandle_t wearMutex;
+
+		static String prefixOf(const String& path);
+};
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include "StorageWorker.h"
+
+// Initialize static variables
+volatile uint32_t StorageWorker::droppedJobs = 0;
+QueueHandle_t StorageWorker::highQueue = NULL;
+QueueHandle_t StorageWorker::lowQueue = NULL;
+SemaphoreHandle_t StorageWorker::jobCount = NULL;
+TaskHandle_t StorageWorker::workerHandle = NULL;
+
+// Dropped jobs are logged at warn level
+static LogModule workerLog("StorageWorker");
+
+/// @brief Starts the storage task. Until it's started, jobs run immediately on the caller's task
+/// @return True on success
+bool StorageWorker::begin() {
+	if (workerHandle != NULL) {
+		return true;
+	}
+	if (highQueue == NULL) {
+		highQueue = xQueueCreate(queueLength, sizeof(Job*));
+	}
+	if (lowQueue == NULL) {
+		lowQueue = xQueueCreate(queueLength, sizeof(Job*));
+	}
+	if (jobCount == NULL) {
+		jobCount = xSemaphoreCreateCounting(queueLength * 2, 0);
+	}
+	if (highQueue == NULL || lowQueue == NULL || jobCount == NULL) {
+		return false;
+	}
+	return xTaskCreate(ioProcessor, "Storage Worker", 8192, NULL, 1, &workerHandle) == pdPASS;
+}
+
+/// @brief Queues an operation to run on the storage task
+/// @param operation The operation
+/// @param callback Called on the storage task once the operation completes, can be nullptr
+/// @param priority The priority of the operation
+/// @return True if the operation was queued (or run, if the storage task isn't started)
+bool StorageWorker::run(Operation operation, Callback callback, Priority priority) {
+	Job* job = new Job { operation, callback, pcTaskGetName(NULL) };
+	if (workerHandle == NULL) {
+		complete(job);
+		return true;
+	}
+	if (xQueueSend(priority == Priority::High ? highQueue : lowQueue, &job, pdMS_TO_TICKS(10)) != pdTRUE) {
+		droppedJobs++;
+		LOG_WARN(workerLog, "Storage queue full, job dropped");
+		delete job;
+		return false;
+	}
+	xSemaphoreGive(jobCount);
+	return true;
+}
+
+/// @brief Reads a file on the storage task
+/// @param path The path of the file to read
+/// @param callback Called with the contents of the file
+/// @param priority The priority of the read
+/// @return True if queued
+bool StorageWorker::readFile(String path, Callback callback, Priority priority) {
+	return run([path](String& result) {
+		if (!Storage::fileExists(path)) {
+			return false;
+		}
+		result = Storage::readFile(path);
+		return true;
+	}, callback, priority);
+}
+
+/// @brief Writes a file on the storage task
+/// @param path The path of the file to write
+/// @param content The content of the file to write
+/// @param callback Called once the file is written, can be nullptr
+/// @param priority The priority of the write
+/// @return True if queued
+bool StorageWorker::writeFile(String path, String content, Callback callback, Priority priority) {
+	return run([path, content](String& result) {
+		return Storage::createParentDirs(path) && Storage::writeFile(path, content);
+	}, callback, priority);
+}
+
+/// @brief Atomically writes a file on the storage task, keeping the previous version as a backup. Until it's written, Storage::recoverFile waits for it rather than treating its temporary file as abandoned
+/// @param path The path of the file to write
+/// @param content The content of the file to write
+/// @param callback Called once the file is written, can be nullptr
+/// @param priority The priority of the write
+/// @return True if queued
+bool StorageWorker::writeFileAtomic(String path, String content, Callback callback, Priority priority) {
+	Storage::holdPath(path);
+	bool queued = run([path, content](String& result) {
+		bool success = Storage::writeFileAtomic(path, content);
+		Storage::releasePath(path);
+		return success;
+	}, callback, priority);
+	if (!queued) {
+		Storage::releasePath(path);
+	}
+	return queued;
+}
+
+/// @brief Appends to a file on the storage task
+/// @param path The path of the file to append to
+/// @param content The content to append
+/// @param callback Called once the content is appended, can be nullptr
+/// @param priority The priority of the append
+/// @return True if queued
+bool StorageWorker::appendToFile(String path, String content, Callback callback, Priority priority) {
+	return run([path, content](String& result) {
+		return Storage::appendToFile(path, content);
+	}, callback, priority);
+}
+
+/// @brief Renames a file on the storage task
+/// @param path1 The original path/name of the file
+/// @param path2 The new path/name of the file
+/// @param callback Called once the file is renamed, can be nullptr
+/// @param priority The priority of the rename
+/// @return True if queued
+bool StorageWorker::renameFile(String path1, String path2, Callback callback, Priority priority) {
+	return run([path1, path2](String& result) {
+		return Storage::renameFile(path1, path2);
+	}, callback, priority);
+}
+
+/// @brief Deletes a file on the storage task
+/// @param path The path of the file to delete
+/// @param callback Called once the file is deleted, can be nullptr
+/// @param priority The priority of the delete
+/// @return True if queued
+bool StorageWorker::deleteFile(String path, Callback callback, Priority priority) {
+	return run([path](String& result) {
+		return Storage::deleteFile(path);
+	}, callback, priority);
+}
+
+/// @brief Gets the number of jobs waiting to run
+/// @return The number of jobs
+size_t StorageWorker::pending() {
+	if (highQueue == NULL || lowQueue == NULL) {
+		return 0;
+	}
+	return uxQueueMessagesWaiting(highQueue) + uxQueueMessagesWaiting(lowQueue);
+}
+
+/// @brief Checks if the storage task is running
+/// @return True if jobs are run on the storage task
+bool StorageWorker::isRunning() {
+	return workerHandle != NULL;
+}
+
+/// @brief Runs a job, calls its callback, and frees it
+/// @param job The job
+void StorageWorker::complete(Job* job) {
+	String result;
+	// Account the writes to the task that queued them
+	StorageWear::attributeTo(job->caller);
+	bool success = job->operation(result);
+	if (job->callback) {
+		job->callback(success, result);
+	}
+	delete job;
+}
+
+/// @brief Runs queued jobs, all high priority jobs first
+/// @param arg Not used
+void StorageWorker::ioProcessor(void* arg) {
+	Job* job;
+	while (true) {
+		if (xSemaphoreTake(jobCount, portMAX_DELAY) == pdTRUE) {
+			if (xQueueReceive(highQueue, &job, 0) == pdTRUE || xQueueReceive(lowQueue, &job, 0) == pdTRUE) {
+				complete(job);
+			}
+		}
+	}
+}
\ No newline at end of file
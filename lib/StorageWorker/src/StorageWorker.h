@@ -0,0 +1,62 @@
+/*
+* This file and associated .cpp file are licensed under the GPLv3 License Copyright (c) 2024 Sam Groveman
+* Contributors: Sam Groveman
+*/
+
+#pragma once
+#include <Arduino.h>
+#include <Storage.h>
+#include <functional>
+
+/// @brief Runs storage operations on a dedicated task so callers (e.g. web handlers and control loops) never wait on the media
+class StorageWorker {
+	public:
+		/// @brief Order jobs are run in. High priority jobs (e.g. saving configurations) run before any waiting low priority jobs (e.g. bulk logging)
+		enum class Priority { High, Low };
+
+		/// @brief An operation to run on the storage task. Returns true on success, and can set the result (e.g. to file contents)
+		typedef std::function<bool(String& result)> Operation;
+
+		/// @brief Called on the storage task when an operation completes, with its success and result
+		typedef std::function<void(bool success, const String& result)> Callback;
+
+		/// @brief Number of jobs dropped because a queue was full
+		static volatile uint32_t droppedJobs;
+
+		static bool begin();
+		static bool run(Operation operation, Callback callback = nullptr, Priority priority = Priority::Low);
+		static bool readFile(String path, Callback callback, Priority priority = Priority::High);
+		static bool writeFile(String path, String content, Callback callback = nullptr, Priority priority = Priority::Low);
+		static bool writeFileAtomic(String path, String content, Callback callback = nullptr, Priority priority = Priority::High);
+		static bool appendToFile(String path, String content, Callback callback = nullptr, Priority priority = Priority::Low);
+		static bool renameFile(String path1, String path2, Callback callback = nullptr, Priority priority = Priority::High);
+		static bool deleteFile(String path, Callback callback = nullptr, Priority priority = Priority::High);
+		static size_t pending();
+		static bool isRunning();
+
+	private:
+		/// @brief A queued operation and its completion callback
+		struct Job {
+			Operation operation;
+			Callback callback;
+			String caller;
+		};
+
+		/// @brief Number of jobs each queue can hold
+		static const size_t queueLength = 16;
+
+		/// @brief Queue of high priority jobs
+		static QueueHandle_t highQueue;
+
+		/// @brief Queue of low priority jobs
+		static QueueHandle_t lowQueue;
+
+		/// @brief Counts jobs waiting in both queues, the storage task sleeps on it
+		static SemaphoreHandle_t jobCount;
+
+		/// @brief Task handle for the storage task
+		static TaskHandle_t workerHandle;
+
+		static void complete(Job* job);
+		static void ioProcessor(void* arg);
+};
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "TimeInterface.h"
 #include <cstdlib>
 #include <cstring>
+#include <climits>
 
 // Initialize static variables
 long TimeInterface::currentOffset = 0;
@@ -95,6 +96,22 @@ long TimeInterface::getLocalEpoch() {
 	return (long)time(nullptr);
 }
 
+/// @brief Gets the number of ms until a time is reached
+/// @param epoch The time in seconds since the Unix epoch (same reference as getLocalEpoch)
+/// @return The number of ms until the time, 0 if the time has passed
+ulong TimeInterface::getMillisUntil(long epoch) {
+	long now = getLocalEpoch();
+	if (epoch <= now) {
+		return 0;
+	}
+	// Clamp to the longest delay that fits in a ulong
+	unsigned long seconds = epoch - now;
+	if (seconds > ULONG_MAX / 1000) {
+		return ULONG_MAX;
+	}
+	return seconds * 1000;
+}
+
 /// @brief Build and apply the TZ string with DST support
 /// @param offset The standard timezone offset in seconds (negative for east)
 /// @param daylight The daylight saving offset in seconds
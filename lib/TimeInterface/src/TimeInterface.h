@@ -14,6 +14,7 @@ class TimeInterface {
 		static void setOffset(long offset, int daylight);
 		static long getEpoch();
 		static long getLocalEpoch();
+		static ulong getMillisUntil(long epoch);
 
 	private:
 		/// @brief Current GMT offset in seconds
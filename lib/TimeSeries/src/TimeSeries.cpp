@@ -0,0 +1,485 @@
+#include "TimeSeries.h"
+
+// Initialize static variables
+std::vector<TimeSeries*> TimeSeries::series;
+SemaphoreHandle_t TimeSeries::seriesMutex = xSemaphoreCreateMutex();
+
+/// @brief Log module for time series
+static LogModule timeSeriesLog("TimeSeries");
+
+/// @brief Creates a time series
+/// @param Path The path of the time-series file
+/// @param FlushInterval Longest time in ms samples wait in memory before they're written
+TimeSeries::TimeSeries(String Path, uint32_t FlushInterval) {
+	path = Path;
+	flushInterval = FlushInterval;
+	mutex = xSemaphoreCreateMutex();
+	memset(&active, 0, sizeof(active));
+	if (xSemaphoreTake(seriesMutex, portMAX_DELAY) == pdTRUE) {
+		series.push_back(this);
+		xSemaphoreGive(seriesMutex);
+	}
+}
+
+/// @brief Writes any samples held in memory and closes the file
+TimeSeries::~TimeSeries() {
+	if (xSemaphoreTake(seriesMutex, portMAX_DELAY) == pdTRUE) {
+		series.erase(std::remove(series.begin(), series.end(), this), series.end());
+		xSemaphoreGive(seriesMutex);
+	}
+	flush();
+	if (file) {
+		file.close();
+	}
+	vSemaphoreDelete(mutex);
+}
+
+/// @brief Opens the file, creating it if needed, and picks up appending where the last block left off
+/// @return True on success
+bool TimeSeries::begin() {
+	if (xSemaphoreTake(mutex, portMAX_DELAY) == pdFALSE) {
+		return false;
+	}
+	if (file) {
+		xSemaphoreGive(mutex);
+		return true;
+	}
+	if (!Storage::fileExists(path)) {
+		Storage::createParentDirs(path);
+		File created = Storage::openFile(path, FILE_WRITE);
+		if (created) {
+			created.close();
+		}
+	}
+	file = Storage::openFile(path, "r+");
+	if (!file) {
+		LOG_ERROR(timeSeriesLog, "Could not open %s", path.c_str());
+		xSemaphoreGive(mutex);
+		return false;
+	}
+	fileSize = file.size();
+	size_t blocks = fileSize / blockSize;
+	memset(&active, 0, sizeof(active));
+	codec = Codec();
+	activeIndex = 0;
+	if (blocks > 0) {
+		// Continue in the last block, replaying it to restore the encoding state
+		activeIndex = blocks - 1;
+		if (file.seek(activeIndex * blockSize) && file.read(reinterpret_cast<uint8_t*>(&active), blockSize) == blockSize && active.header.magic == blockMagic) {
+			int64_t time;
+			double value;
+			for (uint16_t i = 0; i < active.header.count; i++) {
+				decode(active, codec, i, time, value);
+			}
+		} else {
+			LOG_WARN(timeSeriesLog, "Last block of %s is invalid, overwriting it", path.c_str());
+			memset(&active, 0, sizeof(active));
+		}
+	}
+	flushedAt = millis();
+	xSemaphoreGive(mutex);
+	return true;
+}
+
+/// @brief Adds a sample timestamped with the current time
+/// @param value The value
+/// @return True on success
+bool TimeSeries::append(double value) {
+	return append(now(), value);
+}
+
+/// @brief Adds a sample. Samples must be added in time order
+/// @param time The time of the sample in ms since the epoch
+/// @param value The value
+/// @return True on success
+bool TimeSeries::append(int64_t time, double value) {
+	if (xSemaphoreTake(mutex, pdMS_TO_TICKS(1000)) == pdFALSE) {
+		return false;
+	}
+	if (!file || (active.header.count > 0 && time < active.header.lastTime)) {
+		xSemaphoreGive(mutex);
+		return false;
+	}
+	bool success = true;
+	if (!encode(active, codec, time, value)) {
+		// Block is full, seal it and start the next one
+		success = writeBlock();
+		if (success) {
+			activeIndex++;
+			memset(&active, 0, sizeof(active));
+			codec = Codec();
+			success = encode(active, codec, time, value);
+		}
+	}
+	if (success) {
+		dirty = true;
+		if (millis() - flushedAt >= flushInterval) {
+			success = writeBlock();
+		}
+	}
+	xSemaphoreGive(mutex);
+	return success;
+}
+
+/// @brief Writes any samples held in memory to the file
+/// @return True on success
+bool TimeSeries::flush() {
+	if (xSemaphoreTake(mutex, pdMS_TO_TICKS(1000)) == pdFALSE) {
+		return false;
+	}
+	bool success = !dirty || writeBlock();
+	xSemaphoreGive(mutex);
+	return success;
+}
+
+/// @brief Reads the samples in a time range
+/// @param from Start of the time range in ms since the epoch
+/// @param to End of the time range in ms since the epoch
+/// @param callback Called with the time and value of each sample in order, return false to stop reading
+/// @return True on success
+bool TimeSeries::read(int64_t from, int64_t to, std::function<bool(int64_t, double)> callback) {
+	if (!flush()) {
+		return false;
+	}
+	Reader reader(path, from, to);
+	int64_t time;
+	double value;
+	while (reader.next(time, value)) {
+		if (!callback(time, value)) {
+			break;
+		}
+	}
+	return true;
+}
+
+/// @brief Gets the path of the time-series file
+/// @return The path
+String TimeSeries::getPath() {
+	return path;
+}
+
+/// @brief Gets the current time for timestamping samples
+/// @return The time in ms since the epoch
+int64_t TimeSeries::now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return static_cast<int64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+/// @brief Writes the samples held in memory by every time series, e.g. before the files are read or before a reboot
+void TimeSeries::flushAll() {
+	if (xSemaphoreTake(seriesMutex, pdMS_TO_TICKS(1000)) == pdFALSE) {
+		return;
+	}
+	for (const auto& s : series) {
+		s->flush();
+	}
+	xSemaphoreGive(seriesMutex);
+}
+
+/// @brief Writes the active block in place in the file. Must hold the mutex
+/// @return True on success
+bool TimeSeries::writeBlock() {
+	if (!file) {
+		return false;
+	}
+	size_t offset = activeIndex * blockSize;
+	if (offset >= fileSize && blockSize >= Storage::freeSpace(path)) {
+		LOG_ERROR(timeSeriesLog, "Not enough free space to extend %s", path.c_str());
+		return false;
+	}
+	active.header.magic = blockMagic;
+	active.header.timeBits = codec.timeBits;
+	active.header.valueBits = codec.valueBits;
+	if (!file.seek(offset) || file.write(reinterpret_cast<const uint8_t*>(&active), blockSize) != blockSize) {
+		LOG_ERROR(timeSeriesLog, "Failed to write block %u of %s", activeIndex, path.c_str());
+		return false;
+	}
+	file.flush();
+	if (offset >= fileSize) {
+		// Writes through the open file bypass Storage, so count them against the free space
+		Storage::consumeSpace(path, offset + blockSize - fileSize);
+		fileSize = offset + blockSize;
+	} else {
+		Storage::recordWrite(path, blockSize);
+	}
+	dirty = false;
+	flushedAt = millis();
+	return true;
+}
+
+/// @brief Adds a sample to a block
+/// @param block The block
+/// @param codec The encoding state of the block
+/// @param time The time of the sample
+/// @param value The value
+/// @return True on success, false if the sample doesn't fit in the block
+bool TimeSeries::encode(Block& block, Codec& codec, int64_t time, double value) {
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	if (block.header.count == 0) {
+		// The first timestamp is in the header and the first value is stored whole
+		block.header.firstTime = time;
+		codec = Codec();
+		putBits(block.payload, codec.valueBits, true, bits, 64);
+	} else {
+		if (codec.timeBits + codec.valueBits + maxSampleBits > payloadBits || block.header.count == UINT16_MAX) {
+			return false;
+		}
+		int64_t delta = time - codec.time;
+		int64_t dod = delta - codec.delta;
+		if (dod < INT32_MIN || dod > INT32_MAX) {
+			return false;
+		}
+		// Regular intervals give a delta of delta of 0, stored in a single bit
+		if (dod == 0) {
+			putBits(block.payload, codec.timeBits, false, 0b0, 1);
+		} else if (dod >= -64 && dod <= 63) {
+			putBits(block.payload, codec.timeBits, false, 0b10, 2);
+			putBits(block.payload, codec.timeBits, false, dod, 7);
+		} else if (dod >= -256 && dod <= 255) {
+			putBits(block.payload, codec.timeBits, false, 0b110, 3);
+			putBits(block.payload, codec.timeBits, false, dod, 9);
+		} else if (dod >= -2048 && dod <= 2047) {
+			putBits(block.payload, codec.timeBits, false, 0b1110, 4);
+			putBits(block.payload, codec.timeBits, false, dod, 12);
+		} else {
+			putBits(block.payload, codec.timeBits, false, 0b1111, 4);
+			putBits(block.payload, codec.timeBits, false, dod, 32);
+		}
+		// Values are stored as the bits that changed from the previous value
+		uint64_t xored = bits ^ codec.value;
+		if (xored == 0) {
+			putBits(block.payload, codec.valueBits, true, 0b0, 1);
+		} else {
+			uint8_t leading = std::min(__builtin_clzll(xored), 31);
+			uint8_t trailing = __builtin_ctzll(xored);
+			if (codec.leading != 0xFF && leading >= codec.leading && trailing >= codec.trailing) {
+				// Changed bits fit in the previous window
+				putBits(block.payload, codec.valueBits, true, 0b10, 2);
+				putBits(block.payload, codec.valueBits, true, xored >> codec.trailing, 64 - codec.leading - codec.trailing);
+			} else {
+				uint8_t length = 64 - leading - trailing;
+				putBits(block.payload, codec.valueBits, true, 0b11, 2);
+				putBits(block.payload, codec.valueBits, true, leading, 5);
+				putBits(block.payload, codec.valueBits, true, length - 1, 6);
+				putBits(block.payload, codec.valueBits, true, xored >> trailing, length);
+				codec.leading = leading;
+				codec.trailing = trailing;
+			}
+		}
+		codec.delta = delta;
+	}
+	codec.time = time;
+	codec.value = bits;
+	block.header.lastTime = time;
+	block.header.count++;
+	return true;
+}
+
+/// @brief Decodes the next sample in a block. Samples must be decoded in order
+/// @param block The block
+/// @param codec The decoding state of the block
+/// @param index The index of the sample
+/// @param time Set to the time of the sample
+/// @param value Set to the value
+void TimeSeries::decode(const Block& block, Codec& codec, uint16_t index, int64_t& time, double& value) {
+	if (index == 0) {
+		codec = Codec();
+		codec.time = block.header.firstTime;
+		codec.value = getBits(block.payload, codec.valueBits, true, 64);
+	} else {
+		int64_t dod = 0;
+		uint8_t size = 0;
+		if (getBits(block.payload, codec.timeBits, false, 1) == 0) {
+			size = 0;
+		} else if (getBits(block.payload, codec.timeBits, false, 1) == 0) {
+			size = 7;
+		} else if (getBits(block.payload, codec.timeBits, false, 1) == 0) {
+			size = 9;
+		} else if (getBits(block.payload, codec.timeBits, false, 1) == 0) {
+			size = 12;
+		} else {
+			size = 32;
+		}
+		if (size > 0) {
+			// Sign extend
+			dod = static_cast<int64_t>(getBits(block.payload, codec.timeBits, false, size) << (64 - size)) >> (64 - size);
+		}
+		codec.delta += dod;
+		codec.time += codec.delta;
+		if (getBits(block.payload, codec.valueBits, true, 1) == 1) {
+			if (getBits(block.payload, codec.valueBits, true, 1) == 1) {
+				codec.leading = getBits(block.payload, codec.valueBits, true, 5);
+				uint8_t length = getBits(block.payload, codec.valueBits, true, 6) + 1;
+				codec.trailing = 64 - codec.leading - length;
+			}
+			uint8_t length = 64 - codec.leading - codec.trailing;
+			codec.value ^= getBits(block.payload, codec.valueBits, true, length) << codec.trailing;
+		}
+	}
+	time = codec.time;
+	memcpy(&value, &codec.value, sizeof(value));
+}
+
+/// @brief Writes bits to a block's payload, most significant first
+/// @param data The payload
+/// @param position The bit position to write at, advanced past the bits written
+/// @param reverse True to write from the end of the payload towards the front
+/// @param bits The bits to write, in the low bits
+/// @param count The number of bits to write
+void TimeSeries::putBits(uint8_t* data, size_t& position, bool reverse, uint64_t bits, uint8_t count) {
+	for (int i = count - 1; i >= 0; i--) {
+		size_t bit = reverse ? payloadBits - 1 - position : position;
+		// Payloads start zeroed so only set bits need writing
+		if ((bits >> i) & 1) {
+			data[bit / 8] |= 0x80 >> (bit % 8);
+		}
+		position++;
+	}
+}
+
+/// @brief Reads bits from a block's payload
+/// @param data The payload
+/// @param position The bit position to read at, advanced past the bits read
+/// @param reverse True to read from the end of the payload towards the front
+/// @param count The number of bits to read
+/// @return The bits, in the low bits
+uint64_t TimeSeries::getBits(const uint8_t* data, size_t& position, bool reverse, uint8_t count) {
+	uint64_t bits = 0;
+	for (uint8_t i = 0; i < count && position < payloadBits; i++) {
+		size_t bit = reverse ? payloadBits - 1 - position : position;
+		bits = (bits << 1) | ((data[bit / 8] >> (7 - bit % 8)) & 1);
+		position++;
+	}
+	return bits;
+}
+
+/// @brief Opens a time-series file for reading
+/// @param Path The path of the time-series file
+/// @param From Start of the time range in ms since the epoch
+/// @param To End of the time range in ms since the epoch
+TimeSeries::Reader::Reader(String Path, int64_t From, int64_t To) {
+	from = From;
+	to = To;
+	file = Storage::openFile(Path);
+	if (file) {
+		blockCount = file.size() / blockSize;
+		// Only the blocks that can hold samples in the range are read
+		block = findBlock(from, false);
+		endBlock = findBlock(to, true);
+		rawOffset = block * blockSize;
+	}
+}
+
+/// @brief Closes the file
+TimeSeries::Reader::~Reader() {
+	if (file) {
+		file.close();
+	}
+}
+
+/// @brief Gets the next sample in the time range
+/// @param time Set to the time of the sample in ms since the epoch
+/// @param value Set to the value
+/// @return True if a sample was read, false at the end of the range
+bool TimeSeries::Reader::next(int64_t& time, double& value) {
+	while (block < endBlock) {
+		if (!loaded) {
+			if (!readBlock(block, &current, blockSize) || current.header.magic != blockMagic) {
+				block = endBlock;
+				return false;
+			}
+			loaded = true;
+			sample = 0;
+		}
+		if (sample >= current.header.count) {
+			block++;
+			loaded = false;
+			continue;
+		}
+		decode(current, codec, sample++, time, value);
+		if (time > to) {
+			block = endBlock;
+			return false;
+		}
+		if (time >= from) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/// @brief Reads the samples in the time range as CSV text, e.g. to fill a chunked response
+/// @param buffer The buffer to read into
+/// @param size The size of the buffer
+/// @return The number of bytes read, 0 at the end of the range
+size_t TimeSeries::Reader::readCSV(uint8_t* buffer, size_t size) {
+	size_t length = 0;
+	while (length < size) {
+		if (lineOffset == lineLength) {
+			int64_t time;
+			double value;
+			if (!headerSent) {
+				lineLength = snprintf(line, sizeof(line), "time,value\n");
+				headerSent = true;
+			} else if (next(time, value)) {
+				lineLength = snprintf(line, sizeof(line), "%lld,%.15g\n", static_cast<long long>(time), value);
+			} else {
+				break;
+			}
+			lineOffset = 0;
+		}
+		// Lines can be split across reads
+		size_t count = std::min(lineLength - lineOffset, size - length);
+		memcpy(buffer + length, line + lineOffset, count);
+		lineOffset += count;
+		length += count;
+	}
+	return length;
+}
+
+/// @brief Reads the encoded blocks covering the time range, e.g. to download part of a file without decoding it
+/// @param buffer The buffer to read into
+/// @param size The size of the buffer
+/// @return The number of bytes read, 0 at the end of the range
+size_t TimeSeries::Reader::readRaw(uint8_t* buffer, size_t size) {
+	size_t end = endBlock * blockSize;
+	if (!file || rawOffset >= end || !file.seek(rawOffset)) {
+		return 0;
+	}
+	size_t count = file.read(buffer, std::min(size, end - rawOffset));
+	rawOffset += count;
+	return count;
+}
+
+/// @brief Reads all or part of a block
+/// @param index The position of the block in the file
+/// @param buffer The buffer to read into
+/// @param size The number of bytes to read from the start of the block
+/// @return True on success
+bool TimeSeries::Reader::readBlock(size_t index, void* buffer, size_t size) {
+	return file.seek(index * blockSize) && file.read(static_cast<uint8_t*>(buffer), size) == size;
+}
+
+/// @brief Binary searches the block headers
+/// @param time The time to search for
+/// @param after True to find the first block starting after the time, false to find the first block ending at or after it
+/// @return The position of the block, or the number of blocks if there's none
+size_t TimeSeries::Reader::findBlock(int64_t time, bool after) {
+	size_t low = 0;
+	size_t high = blockCount;
+	BlockHeader header;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (!readBlock(middle, &header, sizeof(header))) {
+			return blockCount;
+		}
+		if (after ? header.firstTime > time : header.lastTime >= time) {
+			high = middle;
+		} else {
+			low = middle + 1;
+		}
+	}
+	return low;
+}
\ No newline at end of file
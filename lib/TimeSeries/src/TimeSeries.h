@@ -0,0 +1,198 @@
+/*
+* This file and associated .cpp file are licensed under the GPLv3 License Copyright (c) 2024 Sam Groveman
+* Contributors: Sam Groveman
+*/
+
+#pragma once
+#include <Arduino.h>
+#include <Storage.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <sys/time.h>
+
+/// @brief Stores timestamped values in a compact block format. Each fixed size block holds delta-of-delta encoded timestamps growing from the front and XOR compressed values growing from the back
+class TimeSeries {
+	public:
+		/// @brief Size in bytes of each block in a time-series file
+		static const size_t blockSize = 512;
+
+	private:
+		/// @brief Header at the start of every block. As blocks are fixed size and in time order the headers form an index that can be binary searched
+		struct BlockHeader {
+			/// @brief Time of the first sample in the block
+			int64_t firstTime;
+
+			/// @brief Time of the last sample in the block
+			int64_t lastTime;
+
+			/// @brief Set to blockMagic in a valid block
+			uint16_t magic;
+
+			/// @brief Number of samples in the block
+			uint16_t count;
+
+			/// @brief Number of bits used by the timestamps
+			uint16_t timeBits;
+
+			/// @brief Number of bits used by the values
+			uint16_t valueBits;
+		};
+
+		/// @brief A block as stored in the file
+		struct Block {
+			/// @brief The block header
+			BlockHeader header;
+
+			/// @brief The timestamps from the front and values from the back
+			uint8_t payload[blockSize - sizeof(BlockHeader)];
+		};
+		static_assert(sizeof(BlockHeader) == 24, "Block headers must not be padded");
+
+		/// @brief State carried from one sample to the next while encoding or decoding a block
+		struct Codec {
+			/// @brief Time of the previous sample
+			int64_t time = 0;
+
+			/// @brief Time between the previous two samples
+			int64_t delta = 0;
+
+			/// @brief Bits of the previous value
+			uint64_t value = 0;
+
+			/// @brief Leading zeros of the previous stored XOR, 0xFF if none stored yet
+			uint8_t leading = 0xFF;
+
+			/// @brief Trailing zeros of the previous stored XOR
+			uint8_t trailing = 0;
+
+			/// @brief Bit position in the timestamps
+			size_t timeBits = 0;
+
+			/// @brief Bit position in the values
+			size_t valueBits = 0;
+		};
+
+	public:
+		/// @brief Reads samples from a time-series file, seeking straight to the blocks in the requested time range
+		class Reader {
+			public:
+				Reader(String Path, int64_t From = INT64_MIN, int64_t To = INT64_MAX);
+				~Reader();
+				bool next(int64_t& time, double& value);
+				size_t readCSV(uint8_t* buffer, size_t size);
+				size_t readRaw(uint8_t* buffer, size_t size);
+
+			private:
+				/// @brief The open file
+				File file;
+
+				/// @brief Start of the time range
+				int64_t from;
+
+				/// @brief End of the time range
+				int64_t to;
+
+				/// @brief Number of blocks in the file
+				size_t blockCount = 0;
+
+				/// @brief The block being read
+				size_t block = 0;
+
+				/// @brief One past the last block that can hold samples in the range
+				size_t endBlock = 0;
+
+				/// @brief True when current holds the block being read
+				bool loaded = false;
+
+				/// @brief The block being read
+				Block current;
+
+				/// @brief The decoding state
+				Codec codec;
+
+				/// @brief Index of the next sample in the block
+				uint16_t sample = 0;
+
+				/// @brief Offset of the next byte to read in raw mode
+				size_t rawOffset = 0;
+
+				/// @brief True once the CSV header line has been read
+				bool headerSent = false;
+
+				/// @brief CSV line not yet fully read
+				char line[48];
+
+				/// @brief Length of the CSV line
+				size_t lineLength = 0;
+
+				/// @brief Position in the CSV line
+				size_t lineOffset = 0;
+
+				bool readBlock(size_t index, void* buffer, size_t size);
+				size_t findBlock(int64_t time, bool after);
+		};
+
+		TimeSeries(String Path, uint32_t FlushInterval = 10000);
+		~TimeSeries();
+		bool begin();
+		bool append(double value);
+		bool append(int64_t time, double value);
+		bool flush();
+		bool read(int64_t from, int64_t to, std::function<bool(int64_t, double)> callback);
+		String getPath();
+		static int64_t now();
+		static void flushAll();
+
+	private:
+		/// @brief Marks a valid block
+		static const uint16_t blockMagic = 0x5354;
+
+		/// @brief Number of bits in a block's payload
+		static const size_t payloadBits = sizeof(Block::payload) * 8;
+
+		/// @brief Most bits a single sample can take, a block is sealed when there's less room than this left
+		static const size_t maxSampleBits = 36 + 77;
+
+		/// @brief Every open time series, used to flush them
+		static std::vector<TimeSeries*> series;
+
+		/// @brief Mutex protecting the collection of time series
+		static SemaphoreHandle_t seriesMutex;
+
+		/// @brief The path of the file
+		String path;
+
+		/// @brief The open file
+		File file;
+
+		/// @brief The size of the file on the media
+		size_t fileSize = 0;
+
+		/// @brief The block being appended to, kept in memory and written in place
+		Block active;
+
+		/// @brief Position of the active block in the file
+		size_t activeIndex = 0;
+
+		/// @brief The encoding state of the active block
+		Codec codec;
+
+		/// @brief True when the active block has samples not yet written
+		bool dirty = false;
+
+		/// @brief Longest time in ms samples wait in memory before they're written
+		uint32_t flushInterval;
+
+		/// @brief Time in ms the active block was last written
+		ulong flushedAt = 0;
+
+		/// @brief Mutex protecting the active block and file
+		SemaphoreHandle_t mutex;
+
+		bool writeBlock();
+		static bool encode(Block& block, Codec& codec, int64_t time, double value);
+		static void decode(const Block& block, Codec& codec, uint16_t index, int64_t& time, double& value);
+		static void putBits(uint8_t* data, size_t& position, bool reverse, uint64_t bits, uint8_t count);
+		static uint64_t getBits(const uint8_t* data, size_t& position, bool reverse, uint8_t count);
+};
\ No newline at end of file
@@ -0,0 +1,100 @@
+#include "TokenAuth.h"
+
+/// @brief Creates the middleware with a new signing key
+TokenAuth::TokenAuth() : credentialMiddleware([this](AsyncWebServerRequest *request, ArMiddlewareNext next) {
+	AsyncAuthenticationMiddleware::run(request, next);
+}) {
+	revokeTokens();
+}
+
+/// @brief Lets requests with a valid token through, otherwise authenticates them as usual
+/// @param request The request
+/// @param next Runs the rest of the chain
+void TokenAuth::run(AsyncWebServerRequest *request, ArMiddlewareNext next) {
+	if (validToken(request)) {
+		next();
+	} else {
+		AsyncAuthenticationMiddleware::run(request, next);
+	}
+}
+
+/// @brief Checks if a request has a valid token or credentials. Used by handlers that run before the middleware, such as uploads
+/// @param request The request
+/// @return True if the request is authenticated
+bool TokenAuth::allowed(AsyncWebServerRequest *request) const {
+	return validToken(request) || AsyncAuthenticationMiddleware::allowed(request);
+}
+
+/// @brief Issues a token for the bearer to use in place of credentials
+/// @param lifetime Seconds until the token expires, at most maxLifetime
+/// @return The token, to be sent in an "Authorization: Bearer" header
+String TokenAuth::issueToken(uint32_t lifetime) {
+	uint32_t fields[2] = { uptime() + std::min(lifetime, maxLifetime), ++serial };
+	uint8_t token[payloadSize + signatureSize];
+	memcpy(token, fields, payloadSize);
+	sign(token, token + payloadSize);
+	char hex[sizeof(token) * 2 + 1];
+	for (size_t i = 0; i < sizeof(token); i++) {
+		sprintf(hex + i * 2, "%02x", token[i]);
+	}
+	return String(hex);
+}
+
+/// @brief Invalidates every token issued so far by changing the signing key
+void TokenAuth::revokeTokens() {
+	esp_fill_random(key, sizeof(key));
+}
+
+/// @brief Gets middleware that only accepts credentials, for routes a token mustn't unlock such as issuing new tokens
+/// @return The middleware, shares this middleware's credentials and settings
+AsyncMiddleware* TokenAuth::credentialsOnly() {
+	return &credentialMiddleware;
+}
+
+/// @brief Checks if a request carries an unexpired token signed with the current key
+/// @param request The request
+/// @return True if the token is valid
+bool TokenAuth::validToken(AsyncWebServerRequest *request) const {
+	if (!request->hasHeader("Authorization")) {
+		return false;
+	}
+	const String& header = request->getHeader("Authorization")->value();
+	if (!header.startsWith("Bearer ") || header.length() != 7 + (payloadSize + signatureSize) * 2) {
+		return false;
+	}
+	uint8_t token[payloadSize + signatureSize];
+	for (size_t i = 0; i < sizeof(token); i++) {
+		char byte[3] = { header[7 + i * 2], header[8 + i * 2], '\0' };
+		char* end;
+		token[i] = strtoul(byte, &end, 16);
+		if (end != byte + 2) {
+			return false;
+		}
+	}
+	uint32_t expiry;
+	memcpy(&expiry, token, sizeof(expiry));
+	if (uptime() >= expiry) {
+		return false;
+	}
+	uint8_t signature[signatureSize];
+	sign(token, signature);
+	// Compare every byte so the time taken doesn't reveal how much of a forged signature is right
+	uint8_t difference = 0;
+	for (size_t i = 0; i < signatureSize; i++) {
+		difference |= signature[i] ^ token[payloadSize + i];
+	}
+	return difference == 0;
+}
+
+/// @brief Signs a token payload
+/// @param payload The payload
+/// @param signature Receives the HMAC-SHA256 of the payload
+void TokenAuth::sign(const uint8_t* payload, uint8_t* signature) const {
+	mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), key, sizeof(key), payload, payloadSize, signature);
+}
+
+/// @brief Gets the time since boot, which tokens expire against as the clock may not be set
+/// @return The time in seconds
+uint32_t TokenAuth::uptime() {
+	return esp_timer_get_time() / 1000000;
+}
\ No newline at end of file
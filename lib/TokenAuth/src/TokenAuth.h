@@ -0,0 +1,49 @@
+/*
+* This file and associated .cpp file are licensed under the GPLv3 License Copyright (c) 2024 Sam Groveman
+* 
+* External libraries needed:
+* ESPAsyncWebServer: https://github.com/ESP32Async/ESPAsyncWebServer
+*
+* Contributors: Sam Groveman
+*/
+
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <mbedtls/md.h>
+
+/// @brief Authentication middleware that also accepts bearer tokens it has issued, so clients that have authenticated once skip the digest challenge and hashing on later requests
+class TokenAuth : public AsyncAuthenticationMiddleware {
+	public:
+		/// @brief Longest lifetime in seconds a token can be issued for
+		static const uint32_t maxLifetime = 86400;
+
+		TokenAuth();
+		void run(AsyncWebServerRequest *request, ArMiddlewareNext next) override;
+		bool allowed(AsyncWebServerRequest *request) const;
+		String issueToken(uint32_t lifetime);
+		void revokeTokens();
+		AsyncMiddleware* credentialsOnly();
+
+	private:
+		/// @brief Size in bytes of a token's payload, its expiry and serial number
+		static const size_t payloadSize = 8;
+
+		/// @brief Size in bytes of a token's HMAC-SHA256 signature
+		static const size_t signatureSize = 32;
+
+		/// @brief Secret key tokens are signed with, random at boot so tokens don't outlive a reboot
+		uint8_t key[32];
+
+		/// @brief Serial number of the last token issued
+		uint32_t serial = 0;
+
+		/// @brief Authenticates requests by credentials alone, ignoring tokens
+		AsyncMiddlewareFunction credentialMiddleware;
+
+		bool validToken(AsyncWebServerRequest *request) const;
+		void sign(const uint8_t* payload, uint8_t* signature) const;
+		static uint32_t uptime();
+};
\ No newline at end of file
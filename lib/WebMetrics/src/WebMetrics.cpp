@@ -0,0 +1,141 @@
+#include "WebMetrics.h"
+
+// Initialize static variables
+const uint32_t WebMetrics::buckets[WebMetrics::bucketCount] = { 1, 5, 10, 25, 50, 100, 250, 500, 1000 };
+
+// Slow requests are logged at warn level
+static LogModule metricsLog("WebMetrics");
+
+/// @brief Creates the middleware
+/// @param SlowThreshold Requests taking at least this many ms are logged
+WebMetrics::WebMetrics(uint32_t SlowThreshold) {
+	slowThreshold = SlowThreshold;
+	mutex = xSemaphoreCreateMutex();
+}
+
+/// @brief Times a request through the rest of the middleware chain and its handler, then records the result
+/// @param request The request
+/// @param next Runs the rest of the chain
+void WebMetrics::run(AsyncWebServerRequest *request, ArMiddlewareNext next) {
+	uint32_t heapBefore = ESP.getFreeHeap();
+	int64_t start = esp_timer_get_time();
+	next();
+	uint32_t latency = esp_timer_get_time() - start;
+	// Approximate, other tasks allocate too
+	int32_t heap = static_cast<int32_t>(heapBefore - ESP.getFreeHeap());
+	AsyncWebServerResponse *response = request->getResponse();
+	int code = response != nullptr ? response->code() : 0;
+	size_t bytes = response != nullptr ? bodyLength(response) : 0;
+	bool slow = latency >= slowThreshold * 1000;
+	if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+		String key = routeOf(request, code);
+		if (routes.size() >= maxRoutes && routes.find(key) == routes.end()) {
+			key = "other";
+		}
+		Route& route = routes[key];
+		route.codes[code]++;
+		size_t bucket = 0;
+		while (bucket < bucketCount && latency > buckets[bucket] * 1000) {
+			bucket++;
+		}
+		route.histogram[bucket]++;
+		route.latency += latency;
+		route.bytes += bytes;
+		route.heap += heap;
+		route.heapMax = std::max(route.heapMax, heap);
+		if (slow) {
+			slowRequests++;
+		}
+		xSemaphoreGive(mutex);
+	}
+	if (slow) {
+		LOG_WARN(metricsLog, "Slow request %s %s took %u ms, status %d", request->methodToString(), request->url().c_str(), latency / 1000, code);
+	}
+}
+
+/// @brief Prints the totals in Prometheus text format
+/// @param out Where to print them
+void WebMetrics::printMetrics(Print& out) {
+	if (xSemaphoreTake(mutex, portMAX_DELAY) == pdFALSE) {
+		return;
+	}
+	out.print("# HELP fabrica_http_requests_total Requests handled, by route and status code (0 if answered later)\n# TYPE fabrica_http_requests_total counter\n");
+	for (const auto& route : routes) {
+		for (const auto& code : route.second.codes) {
+			out.printf("fabrica_http_requests_total{route=\"%s\",code=\"%d\"} %u\n", route.first.c_str(), code.first, code.second);
+		}
+	}
+	out.print("# HELP fabrica_http_request_duration_seconds Time from a request arriving to its response being ready, including authentication\n# TYPE fabrica_http_request_duration_seconds histogram\n");
+	for (const auto& route : routes) {
+		uint32_t count = 0;
+		for (size_t bucket = 0; bucket < bucketCount; bucket++) {
+			count += route.second.histogram[bucket];
+			out.printf("fabrica_http_request_duration_seconds_bucket{route=\"%s\",le=\"%g\"} %u\n", route.first.c_str(), buckets[bucket] / 1000.0, count);
+		}
+		count += route.second.histogram[bucketCount];
+		out.printf("fabrica_http_request_duration_seconds_bucket{route=\"%s\",le=\"+Inf\"} %u\n", route.first.c_str(), count);
+		out.printf("fabrica_http_request_duration_seconds_sum{route=\"%s\"} %.6f\n", route.first.c_str(), route.second.latency / 1000000.0);
+		out.printf("fabrica_http_request_duration_seconds_count{route=\"%s\"} %u\n", route.first.c_str(), count);
+	}
+	out.print("# HELP fabrica_http_response_bytes_total Bytes of response bodies, by route\n# TYPE fabrica_http_response_bytes_total counter\n");
+	for (const auto& route : routes) {
+		out.printf("fabrica_http_response_bytes_total{route=\"%s\"} %llu\n", route.first.c_str(), route.second.bytes);
+	}
+	out.print("# HELP fabrica_http_heap_retained_bytes_total Heap still in use after handling requests, by route\n# TYPE fabrica_http_heap_retained_bytes_total counter\n");
+	for (const auto& route : routes) {
+		out.printf("fabrica_http_heap_retained_bytes_total{route=\"%s\"} %lld\n", route.first.c_str(), route.second.heap);
+	}
+	out.print("# HELP fabrica_http_heap_retained_bytes_max Most heap still in use after handling a request, by route\n# TYPE fabrica_http_heap_retained_bytes_max gauge\n");
+	for (const auto& route : routes) {
+		out.printf("fabrica_http_heap_retained_bytes_max{route=\"%s\"} %d\n", route.first.c_str(), route.second.heapMax);
+	}
+	uint32_t slow = slowRequests;
+	xSemaphoreGive(mutex);
+	printMetric(out, "fabrica_http_slow_requests_total", "counter", "Requests slower than the slow request threshold", slow);
+}
+
+/// @brief Sets how long a request can take before it's logged
+/// @param threshold The threshold in ms
+void WebMetrics::setSlowThreshold(uint32_t threshold) {
+	slowThreshold = threshold;
+}
+
+/// @brief Prints a metric without labels in Prometheus text format
+/// @param out Where to print it
+/// @param name The name of the metric
+/// @param type The Prometheus type, e.g. "counter" or "gauge"
+/// @param help A description of the metric
+/// @param value The value
+void WebMetrics::printMetric(Print& out, const char* name, const char* type, const char* help, double value) {
+	out.printf("# HELP %s %s\n# TYPE %s %s\n%s %.15g\n", name, help, name, type, name, value);
+}
+
+/// @brief Gets the route a request is counted under. Web files are counted together, as are unknown URLs, so they can't use up the routes
+/// @param request The request
+/// @param code The status code of the response
+/// @return The route
+String WebMetrics::routeOf(AsyncWebServerRequest *request, int code) {
+	if (code == HTTP_CODE_NOT_FOUND) {
+		return "not found";
+	}
+	String url = request->url();
+	if (url == "/" || url.substring(url.lastIndexOf('/')).indexOf('.') >= 0) {
+		return "files";
+	}
+	// Labels are quoted, keep the URL from breaking out of them
+	url.replace("\\", "\\\\");
+	url.replace("\"", "\\\"");
+	return url;
+}
+
+/// @brief Gets the length of a response body. The server only exposes it to responses, so it's read through a member pointer taken in a derived class
+/// @param response The response
+/// @return The length in bytes, 0 if not known up front
+size_t WebMetrics::bodyLength(AsyncWebServerResponse *response) {
+	struct LengthReader : AsyncWebServerResponse {
+		static size_t read(AsyncWebServerResponse *response) {
+			return response->*(&LengthReader::_contentLength);
+		}
+	};
+	return LengthReader::read(response);
+}
\ No newline at end of file
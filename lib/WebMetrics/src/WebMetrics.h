@@ -0,0 +1,71 @@
+/*
+* This file and associated .cpp file are licensed under the GPLv3 License Copyright (c) 2024 Sam Groveman
+* 
+* External libraries needed:
+* ESPAsyncWebServer: https://github.com/ESP32Async/ESPAsyncWebServer
+*
+* Contributors: Sam Groveman
+*/
+
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <LogBroadcaster.h>
+#include <esp_timer.h>
+#include <map>
+
+/// @brief Middleware that records request counts, status codes, latencies, bytes sent and heap use by route, and logs slow requests. Add it to the server before any other middleware so its timings include them
+class WebMetrics : public AsyncMiddleware {
+	public:
+		WebMetrics(uint32_t SlowThreshold = 500);
+		void run(AsyncWebServerRequest *request, ArMiddlewareNext next) override;
+		void printMetrics(Print& out);
+		void setSlowThreshold(uint32_t threshold);
+		static void printMetric(Print& out, const char* name, const char* type, const char* help, double value);
+
+	private:
+		/// @brief Number of latency histogram buckets, not counting the catch-all
+		static const size_t bucketCount = 9;
+
+		/// @brief Upper bounds in ms of the latency histogram buckets
+		static const uint32_t buckets[bucketCount];
+
+		/// @brief Most routes tracked, requests to any others are counted under "other"
+		static const size_t maxRoutes = 48;
+
+		/// @brief Totals for a route
+		struct Route {
+			/// @brief Requests by status code, 0 for requests answered later (e.g. after a storage job)
+			std::map<int, uint32_t> codes;
+
+			/// @brief Requests by latency bucket, the last for requests slower than every bucket
+			uint32_t histogram[bucketCount + 1] = {};
+
+			/// @brief Total latency in microseconds
+			uint64_t latency = 0;
+
+			/// @brief Total bytes of response bodies, not counting chunked responses whose length isn't known up front
+			uint64_t bytes = 0;
+
+			/// @brief Total heap still in use after handling requests, mostly queued responses
+			int64_t heap = 0;
+
+			/// @brief Most heap still in use after handling a request
+			int32_t heapMax = 0;
+		};
+
+		/// @brief Totals by route
+		std::map<String, Route> routes;
+
+		/// @brief Requests taking at least this many ms are logged
+		uint32_t slowThreshold;
+
+		/// @brief Number of slow requests
+		uint32_t slowRequests = 0;
+
+		/// @brief Mutex protecting the totals
+		SemaphoreHandle_t mutex;
+
+		static String routeOf(AsyncWebServerRequest *request, int code);
+		static size_t bodyLength(AsyncWebServerResponse *response);
+};
\ No newline at end of file
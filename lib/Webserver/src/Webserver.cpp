@@ -9,7 +9,7 @@ extern bool POSTSuccess;
 // Initialize static variables
 bool Webserver::upload_abort = false;
 int Webserver::upload_response_code = 201;
-AsyncAuthenticationMiddleware Webserver::authMiddleware;
+TokenAuth Webserver::authMiddleware;
 
 /// @brief Creates a Webserver object
 /// @param Webserver A pointer to an AsyncWebServer object
@@ -26,6 +26,8 @@ bool Webserver::ServerStart() {
 	authMiddleware.setUsername(Configuration::currentConfig.webUsername.c_str());
 	authMiddleware.setPassword(Configuration::currentConfig.webPassword.c_str());
 	authMiddleware.setAuthFailureMessage("Authentication failed");
+	// Record metrics first so they include the time taken by the other middleware, such as authentication
+	server->addMiddleware(&metricsMiddleware);
 	//Set auth type
 	if(Configuration::currentConfig.useDigestAuth) {
 		Logger.println("Using digest auth");
@@ -37,6 +39,8 @@ bool Webserver::ServerStart() {
 		server->addMiddleware(&corsMiddleware);
 	}
 	authMiddleware.generateHash();
+	// Credentials may have changed, and the radio is up now so the new key is truly random
+	authMiddleware.revokeTokens();
 
 	// Set CORS options
 	corsMiddleware.setOrigin("*");
@@ -46,22 +50,15 @@ bool Webserver::ServerStart() {
 	// Create root directory if needed
 	if (!Storage::fileExists("/www")) {
 		if (!Storage::createDir("/www")) {
+			#ifndef FABRICA_EMBED_WWW
 			return false;
+			#else
+			// The web interface is in the firmware, only files added to it are lost
+			Logger.println("Could not create /www");
+			#endif
 		}
 	}
 
-	// Add request handler for index page
-	if (Storage::fileExists("/www/index.html")) {
-		// Serve any page from filesystem
-		server->serveStatic("/", *Storage::getFileSystem(), "/www/").setDefaultFile("index.html").addMiddleware(&authMiddleware);
-	} else {
-		// Serve the embedded index page
-		server->on("/", HTTP_GET, [this](AsyncWebServerRequest *request) {
-			AsyncWebServerResponse *response = request->beginResponse(HTTP_CODE_OK, "text/html", index_page);
-			request->send(response);
-		}).addMiddleware(&authMiddleware);
-	}
-
 	// Handle file uploads
 	server->on("/upload-file", HTTP_POST, [](AsyncWebServerRequest *request) {
 		// Let upload start
@@ -77,15 +74,18 @@ bool Webserver::ServerStart() {
 		if(request->hasParam("path", true)) {
 			String path = request->getParam("path", true)->value();
 			Logger.println("Deleting " + path);
-			if (Storage::fileExists(path)) {
+			respondAfterStorage(request, [path](String& result) {
+				if (!Storage::fileExists(path)) {
+					result = "File doesn't exist";
+					return HTTP_CODE_BAD_REQUEST;
+				}
 				if (!Storage::deleteFile(path)) {
-					request->send(HTTP_CODE_INTERNAL_SERVER_ERROR, "text/plain", "Could not delete file");
-				} else {
-					request->send(HTTP_CODE_OK, "application/json", "{\"file\":\"" + path + "\"}");
+					result = "Could not delete file";
+					return HTTP_CODE_INTERNAL_SERVER_ERROR;
 				}
-			} else {
-				request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "File doesn't exist");
-			}
+				result = "{\"file\":\"" + path + "\"}";
+				return HTTP_CODE_OK;
+			}, "application/json");
 		} else {
 			request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Bad request data");
 		}
@@ -93,14 +93,16 @@ bool Webserver::ServerStart() {
 
 	// Get descriptions of available sensors
 	server->on("/sensors/", HTTP_GET, [this](AsyncWebServerRequest *request) {
-		request->send(HTTP_CODE_OK, "application/json", SensorManager::getSensorInfo());
+		sendCached(request, "/sensors/", SensorManager::getSensorInfo);
 	}).addMiddleware(&authMiddleware);
 
 	// Get curent configuration of a sensor
 	server->on("/sensors/config", HTTP_GET, [this](AsyncWebServerRequest *request) {
 		if (request->hasParam("sensor")) {
 			int sensorPosID = request->getParam("sensor")->value().toInt();
-			request->send(HTTP_CODE_OK, "application/json", SensorManager::getSensorConfig(sensorPosID));
+			sendCached(request, "/sensors/config?sensor=" + String(sensorPosID), [sensorPosID]() {
+				return SensorManager::getSensorConfig(sensorPosID);
+			});
 		} else {
 			request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Bad request data");
 		}
@@ -161,14 +163,16 @@ bool Webserver::ServerStart() {
 
 	// Get descriptions of available actors
 	server->on("/actors/", HTTP_GET, [this](AsyncWebServerRequest *request) {
-		request->send(HTTP_CODE_OK, "application/json", ActorManager::getActorInfo());
+		sendCached(request, "/actors/", ActorManager::getActorInfo);
 	}).addMiddleware(&authMiddleware);
 
 	// Get curent configuration of an actor
 	server->on("/actors/config", HTTP_GET, [this](AsyncWebServerRequest *request) {
 		if (request->hasParam("actor")) {
 			int actorPosID = request->getParam("actor")->value().toInt();
-			request->send(HTTP_CODE_OK, "application/json", ActorManager::getActorConfig(actorPosID));
+			sendCached(request, "/actors/config?actor=" + String(actorPosID), [actorPosID]() {
+				return ActorManager::getActorConfig(actorPosID);
+			});
 		} else {
 			request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Bad request data");
 		}
@@ -191,7 +195,7 @@ bool Webserver::ServerStart() {
 		}
 	}).addMiddleware(&authMiddleware);
 
-	// Adds an action to the action queue using the action's name or ID
+	// Adds an action to the action queue using the action's name or ID, optionally delayed or scheduled for a set time
 	server->on("/actors/add", HTTP_POST, [this](AsyncWebServerRequest *request) {
 		if (POSTSuccess) {
 			if ((request->hasParam("actorID", true) || request->hasParam("actorName", true)) && ((request->hasParam("actionID", true) || request->hasParam("actionName", true)))) {
@@ -200,25 +204,32 @@ bool Webserver::ServerStart() {
 				if (request->hasParam("payload", true)) {
 					payload = request->getParam("payload", true)->value();
 				}
+				// Parse optional scheduling, either a delay in ms or a time in seconds since the Unix epoch
+				ulong delay = 0;
+				if (request->hasParam("time", true)) {
+					delay = TimeInterface::getMillisUntil(request->getParam("time", true)->value().toInt());
+				} else if (request->hasParam("delay", true)) {
+					delay = strtoul(request->getParam("delay", true)->value().c_str(), nullptr, 10);
+				}
 				// Attempt to add action to queue
-				bool success = false;
+				uint32_t ticket = 0;
 				if (request->hasParam("actionID", true)) {
 					if (request->hasParam("actorID", true)) {
-						success = ActorManager::addActionToQueue(request->getParam("actorID", true)->value().toInt(), request->getParam("actionID", true)->value().toInt(), payload);
+						ticket = ActorManager::addActionToQueue(request->getParam("actorID", true)->value().toInt(), request->getParam("actionID", true)->value().toInt(), payload, delay);
 					} else {
-						success = ActorManager::addActionToQueue(request->getParam("actorName", true)->value(), request->getParam("actionID", true)->value().toInt(), payload);
+						ticket = ActorManager::addActionToQueue(request->getParam("actorName", true)->value(), request->getParam("actionID", true)->value().toInt(), payload, delay);
 					}
 				} else {
 					if (request->hasParam("actorID", true)) {
-						success = ActorManager::addActionToQueue(request->getParam("actorID", true)->value().toInt(), request->getParam("actionName", true)->value(), payload);
+						ticket = ActorManager::addActionToQueue(request->getParam("actorID", true)->value().toInt(), request->getParam("actionName", true)->value(), payload, delay);
 					} else {
-						success = ActorManager::addActionToQueue(request->getParam("actorName", true)->value(), request->getParam("actionName", true)->value(), payload);
+						ticket = ActorManager::addActionToQueue(request->getParam("actorName", true)->value(), request->getParam("actionName", true)->value(), payload, delay);
 					}
 				}
-				if (!success) {
+				if (ticket == 0) {
 					request->send(HTTP_CODE_INTERNAL_SERVER_ERROR, "text/plain", "Could not add action to queue");
 				} else {
-					request->send(HTTP_CODE_OK, "text/plain", "OK");
+					request->send(HTTP_CODE_OK, "application/json", "{\"id\":" + String(ticket) + "}");
 				}
 			} else {
 				request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Bad request data");
@@ -228,7 +239,7 @@ bool Webserver::ServerStart() {
 		}
 	}).addMiddleware(&authMiddleware);
 
-	// Adds an action to the action queue using the action's name or ID
+	// Adds an action to the action queue using the action's name or ID, optionally delayed or scheduled for a set time
 	server->on("/actors/add", HTTP_GET, [this](AsyncWebServerRequest *request) {
 		if (POSTSuccess){
 			if ((request->hasParam("actorID") || request->hasParam("actorName")) && ((request->hasParam("actionID") || request->hasParam("actionName")))) {
@@ -237,25 +248,32 @@ bool Webserver::ServerStart() {
 				if (request->hasParam("payload")) {
 					payload = request->getParam("payload")->value();
 				}
+				// Parse optional scheduling, either a delay in ms or a time in seconds since the Unix epoch
+				ulong delay = 0;
+				if (request->hasParam("time")) {
+					delay = TimeInterface::getMillisUntil(request->getParam("time")->value().toInt());
+				} else if (request->hasParam("delay")) {
+					delay = strtoul(request->getParam("delay")->value().c_str(), nullptr, 10);
+				}
 				// Attempt to add action to queue
-				bool success = false;
+				uint32_t ticket = 0;
 				if (request->hasParam("actionID")) {
 					if (request->hasParam("actorID")) {
-						success = ActorManager::addActionToQueue(request->getParam("actorID")->value().toInt(), request->getParam("actionID")->value().toInt(), payload);
+						ticket = ActorManager::addActionToQueue(request->getParam("actorID")->value().toInt(), request->getParam("actionID")->value().toInt(), payload, delay);
 					} else {
-						success = ActorManager::addActionToQueue(request->getParam("actorName")->value(), request->getParam("actionID")->value().toInt(), payload);
+						ticket = ActorManager::addActionToQueue(request->getParam("actorName")->value(), request->getParam("actionID")->value().toInt(), payload, delay);
 					}
 				} else {
 					if (request->hasParam("actorID")) {
-						success = ActorManager::addActionToQueue(request->getParam("actorID")->value().toInt(), request->getParam("actionName")->value(), payload);
+						ticket = ActorManager::addActionToQueue(request->getParam("actorID")->value().toInt(), request->getParam("actionName")->value(), payload, delay);
 					} else {
-						success = ActorManager::addActionToQueue(request->getParam("actorName")->value(), request->getParam("actionName")->value(), payload);
+						ticket = ActorManager::addActionToQueue(request->getParam("actorName")->value(), request->getParam("actionName")->value(), payload, delay);
 					}
 				}
-				if (!success) {
+				if (ticket == 0) {
 					request->send(HTTP_CODE_INTERNAL_SERVER_ERROR, "text/plain", "Could not add action to queue");
 				} else {
-					request->send(HTTP_CODE_OK, "text/plain", "OK");
+					request->send(HTTP_CODE_OK, "application/json", "{\"id\":" + String(ticket) + "}");
 				}
 			} else {
 				request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Bad request data");
@@ -265,6 +283,16 @@ bool Webserver::ServerStart() {
 		}
 	}).addMiddleware(&authMiddleware);
 
+	// Gets the status and any response of a queued action using the ID returned when it was added
+	server->on("/actors/result", HTTP_GET, [this](AsyncWebServerRequest *request) {
+		if (request->hasParam("id")) {
+			uint32_t ticket = strtoul(request->getParam("id")->value().c_str(), nullptr, 10);
+			request->send(HTTP_CODE_OK, "application/json", ActorManager::getActionResult(ticket));
+		} else {
+			request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Bad request data");
+		}
+	}).addMiddleware(&authMiddleware);
+
 	// Sends an action to an actor immediately using the action's name or ID, and returns any response
 	server->on("/actors/execute", HTTP_GET, [this](AsyncWebServerRequest *request) {
 		if (POSTSuccess){
@@ -341,7 +369,7 @@ bool Webserver::ServerStart() {
 
 	// Get curent global configuration
 	server->on("/config", HTTP_GET, [this](AsyncWebServerRequest *request) {
-		request->send(HTTP_CODE_OK, "application/json", Configuration::getConfig());
+		sendCached(request, "/config", Configuration::getConfig);
 	}).addMiddleware(&authMiddleware);
 
 	// Update global configuration
@@ -353,11 +381,16 @@ bool Webserver::ServerStart() {
 			// Attempt to apply config data
 			if (Configuration::updateConfig(config_string)) {
 				if (save) {
-					// Attempt to save config
-					if(!Configuration::saveConfig(config_string)) {
-						request->send(HTTP_CODE_INTERNAL_SERVER_ERROR, "text/plain", "Could not save config settings");
-						return;
-					}
+					// Attempt to save config on the storage task, ahead of queued file jobs
+					respondAfterStorage(request, [config_string](String& result) {
+						if (!Configuration::saveConfig(config_string)) {
+							result = "Could not save config settings";
+							return HTTP_CODE_INTERNAL_SERVER_ERROR;
+						}
+						result = "OK";
+						return HTTP_CODE_OK;
+					});
+					return;
 				}
 				request->send(HTTP_CODE_OK, "text/plain", "OK");
 			} else {
@@ -390,17 +423,107 @@ bool Webserver::ServerStart() {
 		}
 	}).addMiddleware(&authMiddleware);
 
+	// Gets the log output kept from before the last reset
+	server->on("/logs/previous", HTTP_GET, [this](AsyncWebServerRequest *request) {
+		if (LogTail::getPrevious().isEmpty()) {
+			request->send(HTTP_CODE_NOT_FOUND, "text/plain", "No log kept from before the last reset");
+			return;
+		}
+		AsyncWebServerResponse *response = request->beginResponse(HTTP_CODE_OK, "text/plain", LogTail::getPrevious());
+		response->addHeader("X-Reset-Reason", LogTail::getResetReason());
+		request->send(response);
+	}).addMiddleware(&authMiddleware);
+
+	// Gets the log level of every log module
+	server->on("/logs/levels", HTTP_GET, [this](AsyncWebServerRequest *request) {
+		request->send(HTTP_CODE_OK, "application/json", LogBroadcaster::getModuleLevels());
+	}).addMiddleware(&authMiddleware);
+
+	// Sets the log level of a log module
+	server->on("/logs/levels", HTTP_POST, [this](AsyncWebServerRequest *request) {
+		if (request->hasParam("module", true) && request->hasParam("level", true)) {
+			String module = request->getParam("module", true)->value();
+			int level = request->getParam("level", true)->value().toInt();
+			if (LogBroadcaster::setModuleLevel(module, level)) {
+				request->send(HTTP_CODE_OK, "text/plain", "OK");
+			} else {
+				request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Unknown module or invalid level");
+			}
+		} else {
+			request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Bad request data");
+		}
+	}).addMiddleware(&authMiddleware);
+
+	// Issue a bearer token, so later requests can skip the authentication challenge and hashing. Needs credentials, so a token can't be used to renew itself
+	server->on("/auth/token", HTTP_POST, [this](AsyncWebServerRequest *request) {
+		uint32_t lifetime = request->hasParam("lifetime", true) ? request->getParam("lifetime", true)->value().toInt() : 3600;
+		if (lifetime == 0) {
+			request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Bad request data");
+			return;
+		}
+		lifetime = std::min(lifetime, TokenAuth::maxLifetime);
+		request->send(HTTP_CODE_OK, "application/json", "{\"token\":\"" + authMiddleware.issueToken(lifetime) + "\",\"expires\":" + String(lifetime) + "}");
+	}).addMiddleware(authMiddleware.credentialsOnly());
+
+	// Revoke all bearer tokens
+	server->on("/auth/token", HTTP_DELETE, [this](AsyncWebServerRequest *request) {
+		authMiddleware.revokeTokens();
+		request->send(HTTP_CODE_OK, "text/plain", "OK");
+	}).addMiddleware(&authMiddleware);
+
 	// Handle request for the amount of free space on the storage device (example of returning JSON data)
 	server->on("/freeSpace", HTTP_GET, [this](AsyncWebServerRequest *request) {	
-		String result = "{ \"space\": " + String(Storage::freeSpace()) + " }";
+		// Space on the media a path is stored on, or the primary media
+		size_t space = request->hasParam("path") ? Storage::freeSpace(request->getParam("path")->value()) : Storage::freeSpace();
+		String result = "{ \"space\": " + String(space) + " }";
 		request->send(HTTP_CODE_OK, "application/json", result);
 	}).addMiddleware(&authMiddleware);
 
+	// Handle request for storage write totals and the estimated flash life
+	server->on("/storage/wear", HTTP_GET, [this](AsyncWebServerRequest *request) {
+		request->send(HTTP_CODE_OK, "application/json", StorageWear::getWear());
+	}).addMiddleware(&authMiddleware);
+
+	// Handle setting the write budget of a path prefix
+	server->on("/storage/wear", HTTP_POST, [this](AsyncWebServerRequest *request) {
+		if (request->hasParam("prefix", true) && request->hasParam("budget", true)) {
+			// Only accept a plain count of bytes, a negative number would wrap to no limit
+			const String& value = request->getParam("budget", true)->value();
+			char* end;
+			unsigned long budget = strtoul(value.c_str(), &end, 10);
+			if (value.length() == 0 || !isDigit(value[0]) || *end != '\0') {
+				request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Budget must be a number of bytes");
+				return;
+			}
+			StorageWear::setBudget(request->getParam("prefix", true)->value(), budget);
+			request->send(HTTP_CODE_OK, "text/plain", "OK");
+		} else {
+			request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Bad request data");
+		}
+	}).addMiddleware(&authMiddleware);
+
+	// Handle request for request handling metrics and dropped work counters, in Prometheus text format
+	server->on("/metrics", HTTP_GET, [this](AsyncWebServerRequest *request) {
+		AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+		metricsMiddleware.printMetrics(*response);
+		WebMetrics::printMetric(*response, "fabrica_heap_free_bytes", "gauge", "Free heap", ESP.getFreeHeap());
+		WebMetrics::printMetric(*response, "fabrica_heap_min_free_bytes", "gauge", "Least free heap since boot", ESP.getMinFreeHeap());
+		WebMetrics::printMetric(*response, "fabrica_uptime_seconds", "counter", "Time since boot", millis() / 1000.0);
+		WebMetrics::printMetric(*response, "fabrica_log_dropped_bytes_total", "counter", "Log bytes dropped because the log ring was full", LogBroadcaster::droppedBytes);
+		WebMetrics::printMetric(*response, "fabrica_events_dropped_total", "counter", "Events dropped because the event ring was full", EventBroadcaster::droppedEvents);
+		WebMetrics::printMetric(*response, "fabrica_livestream_dropped_clients_total", "counter", "Live stream clients dropped for falling behind", LiveStream::droppedClients);
+		WebMetrics::printMetric(*response, "fabrica_livestream_dropped_messages_total", "counter", "Live stream messages not streamed because the client list was busy", LiveStream::droppedMessages);
+		WebMetrics::printMetric(*response, "fabrica_storage_dropped_jobs_total", "counter", "Storage jobs dropped because a queue was full", StorageWorker::droppedJobs);
+		request->send(response);
+	}).addMiddleware(&authMiddleware);
+
 	// Handle reset request
 	server->on("/reset", HTTP_PUT, [this](AsyncWebServerRequest *request) {
 		Logger.println("Resetting WiFi settings");
-		 if (Storage::fileExists("/www/reset.html")) {
-			request->send(*Storage::getFileSystem(), "/www/reset.html", "text/html");
+		if (sendEmbedded(request, "/reset.html")) {
+			// Sent from the firmware
+		} else if (Storage::fileExists("/www/reset.html")) {
+			request->send(*Storage::getFileSystem("/www"), "/www/reset.html", "text/html");
 		} else {
 			request->send(HTTP_CODE_OK, "text/plain", "OK");
 		}
@@ -413,8 +536,10 @@ bool Webserver::ServerStart() {
 
 	// Handle reboot request
 	server->on("/reboot", HTTP_PUT, [this](AsyncWebServerRequest *request) {
-		if (Storage::fileExists("/www/reboot.html")) {
-			request->send(*Storage::getFileSystem(), "/www/reboot.html", "text/html");
+		if (sendEmbedded(request, "/reboot.html")) {
+			// Sent from the firmware
+		} else if (Storage::fileExists("/www/reboot.html")) {
+			request->send(*Storage::getFileSystem("/www"), "/www/reboot.html", "text/html");
 		} else {
 			request->send(HTTP_CODE_OK, "text/plain", "OK");
 		}
@@ -425,14 +550,18 @@ bool Webserver::ServerStart() {
 	server->on("/list", HTTP_GET, [this](AsyncWebServerRequest *request) {
 		if (request->hasParam("path")) {
 			String path = request->getParam("path")->value();
-			if (Storage::fileExists(path)) {
-				int depth = 0;
-				if (request->hasParam("depth")) {
-					depth = request->getParam("depth")->value().toInt();
-				}
-				int type = 0;
-				if (request->hasParam("type")) {
-					type =  request->getParam("type")->value().toInt();
+			int depth = 0;
+			if (request->hasParam("depth")) {
+				depth = request->getParam("depth")->value().toInt();
+			}
+			int type = 0;
+			if (request->hasParam("type")) {
+				type =  request->getParam("type")->value().toInt();
+			}
+			respondAfterStorage(request, [path, depth, type](String& result_string) {
+				if (!Storage::fileExists(path)) {
+					result_string = "Folder doesn't exist";
+					return HTTP_CODE_BAD_REQUEST;
 				}
 				std::vector<String> list;
 				if (type == 0) {
@@ -444,11 +573,41 @@ bool Webserver::ServerStart() {
 				for (int i = 0;i < list.size();i++) {
 					result["list"][i] = list[i];
 				}
-				String result_string;
 				serializeJson(result, result_string);
-				request->send(HTTP_CODE_OK, "application/json", result_string);
+				return HTTP_CODE_OK;
+			}, "application/json");
+		} else {
+			request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Bad request data");
+		}
+	}).addMiddleware(&authMiddleware);
+
+	// Handle downloading a time range from a time-series file, decoded to CSV or as raw blocks. Registered before /download, which would match it otherwise
+	server->on("/download/timeseries", HTTP_GET, [this](AsyncWebServerRequest *request) {
+		if (request->hasParam("path")) {
+			String path = request->getParam("path")->value();
+			if (Storage::fileExists(path)) {
+				int64_t from = request->hasParam("from") ? strtoll(request->getParam("from")->value().c_str(), nullptr, 10) : INT64_MIN;
+				int64_t to = request->hasParam("to") ? strtoll(request->getParam("to")->value().c_str(), nullptr, 10) : INT64_MAX;
+				// Make sure samples held in memory are in the file
+				TimeSeries::flushAll();
+				// The reader is freed along with the response
+				std::shared_ptr<TimeSeries::Reader> reader = std::make_shared<TimeSeries::Reader>(path, from, to);
+				String filename = path.substring(path.lastIndexOf('/') + 1);
+				AsyncWebServerResponse *response;
+				if (request->hasParam("format") && request->getParam("format")->value() == "raw") {
+					response = request->beginChunkedResponse("application/octet-stream", [reader](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+						return reader->readRaw(buffer, maxLen);
+					});
+				} else {
+					response = request->beginChunkedResponse("text/csv", [reader](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+						return reader->readCSV(buffer, maxLen);
+					});
+					filename += ".csv";
+				}
+				response->addHeader("Content-Disposition", "attachment; filename=\"" + filename + "\"");
+				request->send(response);
 			} else {
-				request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Folder doesn't exist");
+				request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "File doesn't exist");
 			}
 		} else {
 			request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Bad request data");
@@ -461,7 +620,7 @@ bool Webserver::ServerStart() {
 			String path = request->getParam("path")->value();
 			if (Storage::fileExists(path)) {
 				String filename = path.substring(path.lastIndexOf('/') + 1);
-				AsyncWebServerResponse *response = request->beginResponse(*Storage::getFileSystem(), path, "application/octet-stream");
+				AsyncWebServerResponse *response = request->beginResponse(*Storage::getFileSystem(path), path, "application/octet-stream");
 				response->addHeader("Content-Disposition", "attachment; filename=\"" + filename + "\"");
 				request->send(response);
 			} else {
@@ -472,65 +631,115 @@ bool Webserver::ServerStart() {
 		}
 	}).addMiddleware(&authMiddleware);
 
-	// Allow files to be restored by string input
+	// Allow files to be restored by string input, or streamed from a raw request body
 	server->on("/restorefile", HTTP_POST, [this](AsyncWebServerRequest *request) {
-		if (request->hasParam("path", true) && request->hasParam("contents", true)) {
+		if (request->_tempObject != nullptr) {
+			// Body was queued to the storage task by onRestoreBody
+			int code = *static_cast<int*>(request->_tempObject);
+			if (code == HTTP_CODE_INSUFFICIENT_STORAGE || code == HTTP_CODE_SERVICE_UNAVAILABLE) {
+				// Nothing was written
+				request->send(code, "text/plain", code == HTTP_CODE_SERVICE_UNAVAILABLE ? "Storage busy" : "Could not restore file");
+				return;
+			}
+			// Runs after the queued chunks, check they all made it to the file
+			String path = request->getParam("path")->value();
+			size_t length = request->contentLength();
+			respondAfterStorage(request, [path, length, code](String& result) {
+				File file = Storage::openFile(path);
+				bool complete = file && file.size() == length;
+				file.close();
+				if (code == HTTP_CODE_OK && complete) {
+					result = "File restored";
+					return HTTP_CODE_OK;
+				}
+				// Remove the partial file
+				Storage::deleteFile(path);
+				result = "Could not restore file";
+				return HTTP_CODE_INTERNAL_SERVER_ERROR;
+			});
+		} else if (request->hasParam("path", true) && request->hasParam("contents", true)) {
 			// Change to Unix line endings to save space
 			String content = request->getParam("contents", true)->value();
 			content.replace("\r\n", "\n");
 			// Check for, and create, directories
-			size_t pos = 0;
-			String path_builder = "";
-			// Remove starting '/'
 			String path = request->getParam("path", true)->value();
-			path.remove(0,1);
-			while ((pos = path.indexOf('/')) != -1) {
-				path_builder += "/" + path.substring(0, pos);
-				if (!Storage::fileExists(path_builder)) {
-					Storage::createDir(path_builder);
+			respondAfterStorage(request, [path, content](String& result) {
+				if (Storage::createParentDirs(path) && Storage::writeFile(path, content)) {
+					dropStaleAsset(path);
+					result = "File restored";
+					return HTTP_CODE_OK;
 				}
-				path.remove(0, pos + 1);
-			}
-			if(Storage::writeFile(request->getParam("path", true)->value(), content)) {
-				request->send(HTTP_CODE_OK, "text/plain", "File restored");
-			} else {
-				request->send(HTTP_CODE_INTERNAL_SERVER_ERROR, "text/plain", "Could not restore file");
-			}
+				result = "Could not restore file";
+				return HTTP_CODE_INTERNAL_SERVER_ERROR;
+			});
 		} else {
 			request->send(HTTP_CODE_BAD_REQUEST, "text/plain", "Bad request data");
 		}
-	}).addMiddleware(&authMiddleware);
+	}, nullptr, onRestoreBody).addMiddleware(&authMiddleware);
 
 	// Used to fetch current firmware versions
 	server->on("/version", HTTP_GET, [this](AsyncWebServerRequest *request) {
-		String versions = "{\"hub\":\"" + FW_VERSION + "\",";
-		versions += "\"logreceivers\":" + Logger.getReceiverVersions() + ",";
-		versions += "\"eventreceivers\":" + EventBroadcaster::getReceiverVersions() + ",";
-		versions += "\"sensors\":" + SensorManager::getSensorVersions() + ",";
-		versions += "\"actors\":" + ActorManager::getActorVersions();
-		versions += "}";
-		request->send(HTTP_CODE_OK, "application/json", versions);
+		sendCached(request, "/version", []() {
+			String versions = "{\"hub\":\"" + FW_VERSION + "\",";
+			versions += "\"logreceivers\":" + Logger.getReceiverVersions() + ",";
+			versions += "\"eventreceivers\":" + EventBroadcaster::getReceiverVersions() + ",";
+			versions += "\"sensors\":" + SensorManager::getSensorVersions() + ",";
+			versions += "\"actors\":" + ActorManager::getActorVersions();
+			versions += "}";
+			return versions;
+		});
 	});
 
+	// Progress of a firmware update, and where an interrupted upload should resume from. Registered ahead of /update, which would otherwise match it
+	server->on("/update/status", HTTP_GET, [](AsyncWebServerRequest *request) {
+		request->send(HTTP_CODE_OK, "application/json", FirmwareUpdater::getStatus());
+	}).addMiddleware(&authMiddleware);
+
 	// Update page is special and hard-coded to always be available
 	server->on("/update", HTTP_GET, [this](AsyncWebServerRequest *request) {
-		request->send(HTTP_CODE_OK, "text/html", update_page);
+		sendPage(request, update_page);
 	}).addMiddleware(&authMiddleware);
 
-	// Update firmware
+	// Update firmware, from a form upload or a raw request body
 	server->on("/update", HTTP_POST, [this](AsyncWebServerRequest *request) {
-		// Let update start
-		delay(50);
-		// Check if should reboot
-		if(!Update.hasError()) {
+		int code = request->_tempObject != nullptr ? *static_cast<int*>(request->_tempObject) : HTTP_CODE_BAD_REQUEST;
+		AsyncWebServerResponse *response;
+		if (code == HTTP_CODE_ACCEPTED) {
 			startReboot();
+			delay(100);
+			response = request->beginResponse(HTTP_CODE_ACCEPTED, "text/plain", "OK");
+			response->addHeader("Connection", "close");
+		} else if (code == HTTP_CODE_OK || code == HTTP_CODE_CONFLICT) {
+			// Tell the client where to continue from
+			response = request->beginResponse(code, "text/plain", code == HTTP_CODE_OK ? "Upload incomplete, resume from X-Update-Offset" : "Can't resume from that offset, resume from X-Update-Offset");
+			response->addHeader("X-Update-Offset", String(FirmwareUpdater::getReceived()));
+		} else {
+			response = request->beginResponse(code, "text/plain", code == HTTP_CODE_BAD_REQUEST ? "No firmware received" : "ERROR: " + FirmwareUpdater::getError());
+			response->addHeader("Connection", "close");
 		}
-		delay(100);
-		// Construct response
-		AsyncWebServerResponse *response = request->beginResponse(Webserver::rebooting ? HTTP_CODE_ACCEPTED : HTTP_CODE_INTERNAL_SERVER_ERROR, "text/plain", Webserver::rebooting ? "OK" : "ERROR");
-		response->addHeader("Connection", "close");
 		request->send(response);
-	}, onUpdate).addMiddleware(&authMiddleware);
+	}, onUpdate, onUpdateBody).addMiddleware(&authMiddleware);
+
+	// Stream live logs and events as server-sent events
+	if (!LiveStreamer.attach(server, &authMiddleware)) {
+		Logger.println("Could not attach live stream");
+	}
+
+	// Serve web files compiled into the firmware without touching the file system, ahead of files under /www and the built-in index page
+	server->on("/*", HTTP_GET, [](AsyncWebServerRequest *request) {
+		sendEmbedded(request, request->url());
+	}).setFilter(hasEmbedded).addMiddleware(&authMiddleware);
+
+	// Add request handler for index page, registered last so API routes are matched before the file system is checked
+	if (Storage::fileExists("/www/index.html") || Storage::fileExists("/www/index.html.gz")) {
+		// Serve any page from filesystem
+		server->on("/*", HTTP_GET, serveAsset).setFilter(hasAsset).addMiddleware(&authMiddleware);
+	} else {
+		// Serve the embedded index page
+		server->on("/", HTTP_GET, [this](AsyncWebServerRequest *request) {
+			sendPage(request, index_page);
+		}).addMiddleware(&authMiddleware);
+	}
 
 	// 404 handler
 	server->onNotFound([](AsyncWebServerRequest *request) { 
@@ -543,6 +752,7 @@ bool Webserver::ServerStart() {
 /// @brief Stops the webserver server
 void Webserver::ServerStop() {
 	Logger.println("Stopping web server");
+	LiveStreamer.detach(server);
 	server->reset();
 	server->end();
 }
@@ -563,12 +773,44 @@ void Webserver::Reboot(void* arg) {
 	Logger.println("Rebooting from API call...");
 	// Pause automation before reboot
 	Configuration::currentConfig.tasksEnabled = false;
+	ResponseCache::invalidate();
 	// Delay to show event messages, let server respond, and finish any automation
 	EventBroadcaster::broadcastEvent(EventBroadcaster::Events::Rebooting);
 	delay(3000);
+	// Don't lose buffered appends, samples, or queued storage jobs
+	BufferedAppender::flushAll();
+	TimeSeries::flushAll();
+	for (int i = 0; i < 100 && StorageWorker::pending() > 0; i++) {
+		delay(50);
+	}
+	// Writes held back by budgets and the wear count would be lost too
+	Storage::flushDeferred(true);
+	StorageWear::save();
 	ESP.restart();
 }
 
+/// @brief Runs a storage operation on the storage task, pausing the request until it completes so the web server never waits on the media
+/// @param request The request
+/// @param operation The operation, sets the response body in result and returns the response code
+/// @param type The content type of a successful response, error responses are plain text
+void Webserver::respondAfterStorage(AsyncWebServerRequest *request, std::function<int(String& result)> operation, const char* type) {
+	// Shared between the operation and the callback, both run on the storage task
+	std::shared_ptr<int> code = std::make_shared<int>(HTTP_CODE_INTERNAL_SERVER_ERROR);
+	AsyncWebServerRequestPtr paused = request->pause();
+	bool queued = StorageWorker::run([operation, code](String& result) {
+		*code = operation(result);
+		return *code == HTTP_CODE_OK;
+	}, [paused, code, type](bool success, const String& result) {
+		// The client may have gone away while the operation ran
+		if (auto request = paused.lock()) {
+			request->send(*code, success ? type : "text/plain", result);
+		}
+	}, StorageWorker::Priority::High);
+	if (!queued) {
+		request->send(HTTP_CODE_SERVICE_UNAVAILABLE, "text/plain", "Storage busy");
+	}
+}
+
 /// @brief Handle file uploads to a folder. Adapted from https://github.com/smford/esp32-asyncwebserver-fileupload-example
 /// @param request
 /// @param filename
@@ -590,7 +832,8 @@ void Webserver::onUpload_file(AsyncWebServerRequest *request, String filename, s
 		}
 		String path = request->header("FILE_UPLOAD_PATH");
 		Webserver::upload_abort = false;
-		request->_tempFile = Storage::getFileSystem()->open(path + "/" + filename, "w", true);
+		request->_tempFile = Storage::openFile(path + "/" + filename, FILE_WRITE);
+		dropStaleAsset(path + "/" + filename);
 		Logger.println("Uploading file " + filename);
 	}
 	if (Webserver::upload_abort)
@@ -606,49 +849,350 @@ void Webserver::onUpload_file(AsyncWebServerRequest *request, String filename, s
 	if (final) {
 		// Close the file handle as the upload is now done
 		String path = request->_tempFile.path();
+		size_t size = request->_tempFile.size();
 		request->_tempFile.close();
 		if (Webserver::upload_abort) {
 			// Remove failed upload
 			Storage::deleteFile(path);
 		} else {
+			Storage::consumeSpace(path, size);
 			Webserver::upload_response_code = HTTP_CODE_CREATED;
 		}
 	}
 }
 
-/// @brief Handle firmware update
-/// @param request
-/// @param filename
-/// @param index
-/// @param data
-/// @param len
-/// @param final
-void Webserver::onUpdate(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
-	if(!Webserver::authMiddleware.allowed(request)) {
-		request->send(HTTP_CODE_UNAUTHORIZED, "text/plain", "Authentication failed");
+/// @brief Streams a raw request body to the file given by the path query parameter. Each chunk is queued to the storage task so the web server never waits on the media
+/// @param request The request
+/// @param data The chunk of the body
+/// @param len The length of the chunk
+/// @param index The position of the chunk in the body
+/// @param total The total length of the body
+void Webserver::onRestoreBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+	if (!index) {
+		// The body arrives before middleware runs, so check authentication here
+		if (!Webserver::authMiddleware.allowed(request) || !request->hasParam("path")) {
+			return;
+		}
+		// Holds the response code, freed with the request
+		int* code = static_cast<int*>(malloc(sizeof(int)));
+		if (code == nullptr) {
+			return;
+		}
+		*code = HTTP_CODE_CONTINUE;
+		request->_tempObject = code;
+		if (total >= Storage::freeSpace(request->getParam("path")->value())) {
+			*code = HTTP_CODE_INSUFFICIENT_STORAGE;
+			return;
+		}
+	}
+	if (request->_tempObject == nullptr) {
+		return;
+	}
+	int* code = static_cast<int*>(request->_tempObject);
+	if (*code != HTTP_CODE_CONTINUE) {
+		return;
+	}
+	// The chunk is only valid during this call, so copy it for the storage task
+	std::shared_ptr<std::vector<uint8_t>> chunk = std::make_shared<std::vector<uint8_t>>(data, data + len);
+	String path = request->getParam("path")->value();
+	bool queued = StorageWorker::run([path, chunk, index](String& result) {
+		File file;
+		if (!index) {
+			Storage::createParentDirs(path);
+			file = Storage::openFile(path, FILE_WRITE);
+			dropStaleAsset(path);
+			Logger.println("Restoring file " + path);
+		} else {
+			file = Storage::openFile(path, FILE_APPEND);
+		}
+		// Skip the chunk if an earlier one didn't make it, the request checks the length once all chunks have run
+		if (!file || file.size() != index) {
+			file.close();
+			return false;
+		}
+		size_t written = file.write(chunk->data(), chunk->size());
+		file.close();
+		Storage::consumeSpace(path, written);
+		return written == chunk->size();
+	}, nullptr, StorageWorker::Priority::High);
+	if (!queued) {
+		// Nothing is on the media yet if the first chunk couldn't be queued
+		*code = index ? HTTP_CODE_INTERNAL_SERVER_ERROR : HTTP_CODE_SERVICE_UNAVAILABLE;
 		return;
 	}
+	if (index + len == total) {
+		*code = HTTP_CODE_OK;
+	}
+}
+
+/// @brief Handle firmware update sent as a form upload
+/// @param request The request
+/// @param filename The name of the uploaded file
+/// @param index The position of the chunk in the file
+/// @param data The chunk of the file
+/// @param len The length of the chunk
+/// @param final True if this is the last chunk
+void Webserver::onUpdate(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
 	if (!index) {
 		Logger.printf("Update Start: %s\n", filename.c_str());
-		// Pause automation during update
-		Configuration::currentConfig.tasksEnabled = false;
-		delay(100);
-		EventBroadcaster::broadcastEvent(EventBroadcaster::Events::Updating);
-		// Ensure firmware will fit into flash space
-		if (!Update.begin((ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000)) {
-			Update.printError(Logger);
-		}
 	}
-	if (!Update.hasError()) {
-		if (Update.write(data, len) != len) {
-			Update.printError(Logger);
+	updateChunk(request, index, data, len, final);
+}
+
+/// @brief Handle firmware update sent as a raw request body
+/// @param request The request
+/// @param data The chunk of the body
+/// @param len The length of the chunk
+/// @param index The position of the chunk in the body
+/// @param total The total length of the body
+void Webserver::onUpdateBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+	updateChunk(request, index, data, len, index + len == total);
+}
+
+/// @brief Passes a chunk of a firmware upload to the updater. The X-Update-Offset header resumes an interrupted upload, X-Firmware-Size lets the partition be erased ahead, and X-Firmware-SHA256 is checked before the new firmware is made bootable
+/// @param request The request
+/// @param index The position of the chunk in the upload
+/// @param data The chunk
+/// @param len The length of the chunk
+/// @param final True if this is the last chunk
+void Webserver::updateChunk(AsyncWebServerRequest *request, size_t index, uint8_t *data, size_t len, bool final) {
+	if (!index) {
+		// The body arrives before middleware runs, so check authentication here
+		if (!Webserver::authMiddleware.allowed(request)) {
+			return;
 		}
+		// Holds the response code, freed with the request
+		int* code = static_cast<int*>(malloc(sizeof(int)));
+		if (code == nullptr) {
+			return;
+		}
+		request->_tempObject = code;
+		size_t offset = request->hasHeader("X-Update-Offset") ? request->header("X-Update-Offset").toInt() : 0;
+		size_t size = request->hasHeader("X-Firmware-Size") ? request->header("X-Firmware-Size").toInt() : 0;
+		if (offset == 0) {
+			// Pause automation during update
+			Configuration::currentConfig.tasksEnabled = false;
+			ResponseCache::invalidate();
+			delay(100);
+			EventBroadcaster::broadcastEvent(EventBroadcaster::Events::Updating);
+		}
+		if (FirmwareUpdater::begin(offset, size, request->header("X-Firmware-SHA256"))) {
+			*code = HTTP_CODE_CONTINUE;
+		} else {
+			*code = offset > 0 ? HTTP_CODE_CONFLICT : HTTP_CODE_INTERNAL_SERVER_ERROR;
+		}
+	}
+	if (request->_tempObject == nullptr) {
+		return;
+	}
+	int* code = static_cast<int*>(request->_tempObject);
+	if (*code != HTTP_CODE_CONTINUE) {
+		return;
+	}
+	if (!FirmwareUpdater::write(data, len)) {
+		*code = HTTP_CODE_INTERNAL_SERVER_ERROR;
+		return;
 	}
 	if (final) {
-		if (Update.end(true)) {
+		if (!FirmwareUpdater::finish()) {
+			*code = HTTP_CODE_INTERNAL_SERVER_ERROR;
+		} else if (FirmwareUpdater::getState() == FirmwareUpdater::State::Done) {
 			Logger.printf("Update Success: %uB\n", index + len);
+			*code = HTTP_CODE_ACCEPTED;
 		} else {
-			Update.printError(Logger);
+			// More of the image to come
+			*code = HTTP_CODE_OK;
+		}
+	}
+}
+
+/// @brief Maps a request URL to the file under /www that serves it
+/// @param url The URL
+/// @return The path of the file, or an empty string if the URL can't be a file
+String Webserver::assetPath(const String& url) {
+	if (url.indexOf("..") >= 0) {
+		return "";
+	}
+	String path = "/www" + url;
+	if (path.endsWith("/")) {
+		path += "index.html";
+	}
+	return path;
+}
+
+/// @brief Checks if a request is for a file under /www, or a gzipped copy of one
+/// @param request The request
+/// @return True if there's a file to serve
+bool Webserver::hasAsset(AsyncWebServerRequest *request) {
+	String path = assetPath(request->url());
+	return path != "" && (Storage::fileExists(path + ".gz") || Storage::fileExists(path));
+}
+
+/// @brief Serves a file under /www. A gzipped copy made by www-compress.py is sent instead if the browser accepts it, tagged with the hash of the contents from the gzip trailer so browsers can revalidate instead of downloading it again
+/// @param request The request
+void Webserver::serveAsset(AsyncWebServerRequest *request) {
+	String path = assetPath(request->url());
+	const char* type = contentType(path);
+	// Files only stored gzipped are sent that way regardless, all browsers accept gzip
+	bool gzip = Storage::fileExists(path + ".gz") && (!Storage::fileExists(path) || (request->hasHeader("Accept-Encoding") && request->getHeader("Accept-Encoding")->value().indexOf("gzip") >= 0));
+	if (gzip) {
+		path += ".gz";
+	}
+	// Freed along with the response
+	std::shared_ptr<File> file = std::make_shared<File>(Storage::openFile(path));
+	if (!*file) {
+		request->send(HTTP_CODE_NOT_FOUND);
+		return;
+	}
+	String etag;
+	uint8_t trailer[8];
+	if (gzip && file->size() > sizeof(trailer) && file->seek(file->size() - sizeof(trailer)) && file->read(trailer, sizeof(trailer)) == sizeof(trailer) && file->seek(0)) {
+		// The trailer holds the CRC-32 and length of the uncompressed contents
+		char tag[24];
+		snprintf(tag, sizeof(tag), "\"%02x%02x%02x%02x-%u\"", trailer[3], trailer[2], trailer[1], trailer[0], trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) | (trailer[7] << 24));
+		etag = tag;
+	} else {
+		// Uncompressed files only have their size and modification time to go on
+		etag = "W/\"" + String(file->size(), HEX) + "-" + String(static_cast<uint32_t>(file->getLastWrite()), HEX) + "\"";
+	}
+	if (notModified(request, etag)) {
+		return;
+	}
+	AsyncWebServerResponse *response = request->beginResponse(type, file->size(), [file](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+		return file->read(buffer, maxLen);
+	});
+	response->addHeader("ETag", etag);
+	response->addHeader("Cache-Control", "no-cache");
+	response->addHeader("Vary", "Accept-Encoding");
+	if (gzip) {
+		response->addHeader("Content-Encoding", "gzip");
+	}
+	request->send(response);
+}
+
+/// @brief Checks if a request is for a web file compiled into the firmware with -DFABRICA_EMBED_WWW
+/// @param request The request
+/// @return True if the file is in the firmware
+bool Webserver::hasEmbedded(AsyncWebServerRequest *request) {
+	#ifdef FABRICA_EMBED_WWW
+	String url = request->url();
+	if (url.endsWith("/")) {
+		url += "index.html";
+	}
+	return WwwAssets::find(url.c_str()) != nullptr;
+	#else
+	return false;
+	#endif
+}
+
+/// @brief Sends a web file compiled into the firmware with -DFABRICA_EMBED_WWW. It's sent straight from flash, tagged the same as a gzipped copy on the file system would be
+/// @param request The request
+/// @param url The URL path of the file
+/// @return True if the file is in the firmware and was sent
+bool Webserver::sendEmbedded(AsyncWebServerRequest *request, String url) {
+	#ifdef FABRICA_EMBED_WWW
+	if (url.endsWith("/")) {
+		url += "index.html";
+	}
+	const WwwAssets::Asset* asset = WwwAssets::find(url.c_str());
+	if (asset == nullptr) {
+		return false;
+	}
+	char etag[24];
+	snprintf(etag, sizeof(etag), "\"%08x-%u\"", asset->crc, asset->length);
+	if (notModified(request, etag)) {
+		return true;
+	}
+	// The response reads from the table in flash, the contents are never copied to RAM
+	AsyncWebServerResponse *response = request->beginResponse(HTTP_CODE_OK, asset->type, asset->data, asset->size);
+	response->addHeader("ETag", etag);
+	response->addHeader("Cache-Control", "no-cache");
+	response->addHeader("Vary", "Accept-Encoding");
+	if (asset->gzip) {
+		response->addHeader("Content-Encoding", "gzip");
+	}
+	request->send(response);
+	return true;
+	#else
+	return false;
+	#endif
+}
+
+/// @brief Sends a page embedded in the firmware, tagged with the build time so browsers only download it again after an update
+/// @param request The request
+/// @param page The page
+void Webserver::sendPage(AsyncWebServerRequest *request, const char* page) {
+	static const String etag = [] {
+		String tag = "\"" + FW_VERSION + "-" __DATE__ "-" __TIME__ "\"";
+		tag.replace(" ", "");
+		return tag;
+	}();
+	if (notModified(request, etag)) {
+		return;
+	}
+	AsyncWebServerResponse *response = request->beginResponse(HTTP_CODE_OK, "text/html", page);
+	response->addHeader("ETag", etag);
+	response->addHeader("Cache-Control", "no-cache");
+	request->send(response);
+}
+
+/// @brief Sends a JSON response from the response cache, building it only if it's changed since it was last sent
+/// @param request The request
+/// @param key The route and any parameters that select the response
+/// @param build Builds the response body
+void Webserver::sendCached(AsyncWebServerRequest *request, const String& key, std::function<String()> build) {
+	ResponseCache::Response cached = ResponseCache::get(key, build);
+	if (notModified(request, cached.etag)) {
+		return;
+	}
+	// Sent from the cached body, which stays alive until the response is done with it
+	std::shared_ptr<const String> body = cached.body;
+	AsyncWebServerResponse *response = request->beginResponse("application/json", body->length(), [body](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+		size_t length = std::min(maxLen, body->length() - index);
+		memcpy(buffer, body->c_str() + index, length);
+		return length;
+	});
+	response->addHeader("ETag", cached.etag);
+	response->addHeader("Cache-Control", "no-cache");
+	request->send(response);
+}
+
+/// @brief Sends a 304 response if the browser's cached copy matches
+/// @param request The request
+/// @param etag The entity tag of the current contents
+/// @return True if the response was sent
+bool Webserver::notModified(AsyncWebServerRequest *request, const String& etag) {
+	if (!request->hasHeader("If-None-Match") || request->getHeader("If-None-Match")->value().indexOf(etag) < 0) {
+		return false;
+	}
+	AsyncWebServerResponse *response = request->beginResponse(HTTP_CODE_NOT_MODIFIED);
+	response->addHeader("ETag", etag);
+	response->addHeader("Cache-Control", "no-cache");
+	request->send(response);
+	return true;
+}
+
+/// @brief Deletes the gzipped copy of a file that's been replaced, so the new contents are served
+/// @param path The path of the replaced file
+void Webserver::dropStaleAsset(const String& path) {
+	if (!path.endsWith(".gz") && Storage::fileExists(path + ".gz")) {
+		Storage::deleteFile(path + ".gz");
+	}
+}
+
+/// @brief Gets the content type of a file from its extension
+/// @param path The path of the file
+/// @return The content type
+const char* Webserver::contentType(const String& path) {
+	static const std::pair<const char*, const char*> types[] = {
+		{ ".html", "text/html" }, { ".htm", "text/html" }, { ".css", "text/css" }, { ".js", "application/javascript" },
+		{ ".json", "application/json" }, { ".png", "image/png" }, { ".jpg", "image/jpeg" }, { ".gif", "image/gif" },
+		{ ".svg", "image/svg+xml" }, { ".ico", "image/x-icon" }, { ".txt", "text/plain" }, { ".csv", "text/csv" }
+	};
+	for (const auto& type : types) {
+		if (path.endsWith(type.first)) {
+			return type.second;
 		}
 	}
+	return "application/octet-stream";
 }
\ No newline at end of file
@@ -13,7 +13,6 @@
 #include <ESPAsyncWebServer.h>
 #include <Preferences.h>
 #include <ArduinoJson.h>
-#include <Update.h>
 #include <SD_MMC.h>
 #include <LittleFS.h>
 #include <SD.h>
@@ -25,7 +24,18 @@
 #include <HTTPClient.h>
 #include <EventBroadcaster.h>
 #include <LogBroadcaster.h>
+#include <LiveStream.h>
+#include <BufferedAppender.h>
+#include <TimeSeries.h>
+#include <FirmwareUpdater.h>
+#include <StorageWorker.h>
+#include <ResponseCache.h>
+#include <WebMetrics.h>
+#include <TokenAuth.h>
 #include <vector>
+#ifdef FABRICA_EMBED_WWW
+#include <www_assets.h>
+#endif
 
 /// @brief Local web server.
 class Webserver {
@@ -47,8 +57,8 @@ class Webserver {
 		/// @brief Used to indicate the status code of the last upload
 		static int upload_response_code;
 
-		/// @brief Authentication middleware for auth
-		static AsyncAuthenticationMiddleware authMiddleware;
+		/// @brief Authentication middleware for auth, also accepts bearer tokens from /auth/token
+		static TokenAuth authMiddleware;
 		
 		/// @brief CORS middleware
 		AsyncCorsMiddleware corsMiddleware;
@@ -73,10 +83,27 @@ class Webserver {
 		/// @brief CORS middleware fix
 		CORSAuthFixMiddleware corsMiddlewareFix;
 
+		/// @brief Request metrics middleware
+		WebMetrics metricsMiddleware;
+
 		bool startReboot();
 		static void Reboot(void* arg);
 		static void onUpload_file(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final);
 		static void onUpdate(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final);
+		static void onUpdateBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+		static void updateChunk(AsyncWebServerRequest *request, size_t index, uint8_t *data, size_t len, bool final);
+		static void onRestoreBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+		static void respondAfterStorage(AsyncWebServerRequest *request, std::function<int(String& result)> operation, const char* type = "text/plain");
+		static String assetPath(const String& url);
+		static bool hasAsset(AsyncWebServerRequest *request);
+		static void serveAsset(AsyncWebServerRequest *request);
+		static bool hasEmbedded(AsyncWebServerRequest *request);
+		static bool sendEmbedded(AsyncWebServerRequest *request, String url);
+		static void sendPage(AsyncWebServerRequest *request, const char* page);
+		static void sendCached(AsyncWebServerRequest *request, const String& key, std::function<String()> build);
+		static bool notModified(AsyncWebServerRequest *request, const String& etag);
+		static void dropStaleAsset(const String& path);
+		static const char* contentType(const String& path);
 };
 
 // @brief Text of update webpage
@@ -119,38 +146,56 @@ let uprog = {
 		uprog.hPercent.innerHTML = percent + '%';
 		if (percent === 100) uprog.hFile.disabled = false;
 	},
-	upload: (path) => {
-		return new Promise((resolve, reject) => {
-			if (uprog.hFile.files.length == 0) {
-				reject(new Error('No file selected'));
+	upload: async () => {
+		if (uprog.hFile.files.length == 0) {
+			return;
+		}
+		let file = uprog.hFile.files[0];
+		uprog.hFile.disabled = true;
+		uprog.hFile.value = '';
+		let headers = { 'X-Firmware-Size': file.size };
+		// Only available over HTTPS
+		if (window.crypto && crypto.subtle) {
+			const digest = await crypto.subtle.digest('SHA-256', await file.arrayBuffer());
+			headers['X-Firmware-SHA256'] = Array.from(new Uint8Array(digest)).map((b) => b.toString(16).padStart(2, '0')).join('');
+		}
+		// Resume interrupted uploads from where the hub got to
+		let offset = 0;
+		for (let attempt = 0; attempt < 5; attempt++) {
+			const result = await uprog.send(file, offset, headers);
+			if (result.status === 202) {
+				uprog.update(100);
+				document.getElementById('message').innerHTML = 'Update success, rebooting!';
 				return;
 			}
-			
-			let file = uprog.hFile.files[0];
-			uprog.hFile.disabled = true;
-			uprog.hFile.value = '';
-			let xhr = new XMLHttpRequest(), data = new FormData();
-			data.append('upfile', file);
+			if (result.status !== 0 && result.status !== 200 && result.status !== 409) {
+				document.getElementById('message').innerHTML = result.response;
+				break;
+			}
+			offset = result.offset;
+		}
+		uprog.hFile.disabled = false;
+	},
+	send: (file, offset, headers) => {
+		return new Promise((resolve) => {
+			let xhr = new XMLHttpRequest();
 			xhr.open('POST', '/update');
-			
-			let percent = 0;
-			xhr.upload.onloadstart = () => uprog.update(0);
-			xhr.upload.onprogress = (evt) => uprog.update(Math.ceil((evt.loaded / evt.total) * 100));
-			xhr.upload.onloadend = () => uprog.update(100);
-			
-			xhr.onload = function() {
-				if (this.status !== 202) {
-					document.getElementById('message').innerHTML = this.response;
-					reject(new Error(this.response));
-				} else {
-					uprog.update(100);
-					document.getElementById('message').innerHTML = 'Update success, rebooting!';
-					resolve(this.response);
+			for (const name in headers) {
+				xhr.setRequestHeader(name, headers[name]);
+			}
+			xhr.setRequestHeader('X-Update-Offset', offset);
+			xhr.setRequestHeader('Content-Type', 'application/octet-stream');
+			xhr.upload.onprogress = (evt) => uprog.update(Math.floor(((offset + evt.loaded) / file.size) * 100));
+			xhr.onload = () => resolve({ status: xhr.status, response: xhr.response, offset: parseInt(xhr.getResponseHeader('X-Update-Offset')) || 0 });
+			xhr.onerror = async () => {
+				try {
+					const status = await (await fetch('/update/status')).json();
+					resolve({ status: 0, offset: status.state === 'receiving' ? status.received : 0 });
+				} catch (e) {
+					resolve({ status: 0, offset: 0 });
 				}
 			};
-			
-			xhr.onerror = () => reject(new Error('Network error'));
-			xhr.send(data);
+			xhr.send(file.slice(offset));
 		});
 	}
 };
@@ -0,0 +1,179 @@
+#!/usr/bin/python3
+
+# Decodes binary logs produced when building with -DFABRICA_LOG_BINARY.
+#
+# As a PlatformIO extra script it writes the format table for the build to ${BUILD_DIR}/log-formats.json.
+# From the command line it expands a captured log (file or stdin) back to text:
+#   python3 log-decoder.py [--table log-formats.json] [--source DIR ...] [--base64] [LOG_FILE]
+# With --base64 the input is a capture of the /live event stream, whose "logbin" events carry the log base64 encoded.
+# Without a table the sources next to this script are scanned for formats instead.
+
+import argparse
+import base64
+import binascii
+import codecs
+import json
+import os
+import re
+import struct
+import sys
+
+MARKER = 0x1E
+HEADER = struct.Struct("<BBBII")
+LEVELS = "-EWIDT"
+
+MODULE_PATTERN = re.compile(r'\bLogModule\s+\w+\s*\(\s*"((?:[^"\\]|\\.)*)"')
+FORMAT_PATTERN = re.compile(r'\bLOG_(?:ERROR|WARN|INFO|DEBUG|TRACE)\s*\(\s*\w+\s*,\s*((?:"(?:[^"\\]|\\.)*"\s*)+)')
+LITERAL_PATTERN = re.compile(r'"((?:[^"\\]|\\.)*)"')
+CONVERSION_PATTERN = re.compile(r"%[-+ #0]*(\d+|\*)?(?:\.(\d+|\*))?(hh|h|ll|l|z|j|t)?([diouxXcsfFeEgGaAp%])")
+
+
+def fnv1a(text):
+    hash = 2166136261
+    for byte in text.encode("utf-8"):
+        hash = ((hash ^ byte) * 16777619) & 0xFFFFFFFF
+    return hash
+
+
+def unescape(literal):
+    return codecs.decode(literal, "unicode_escape")
+
+
+def scan_sources(directories):
+    """Builds the module and format tables from the LogModule declarations and LOG_* calls in the sources"""
+    modules = {}
+    formats = {}
+    for directory in directories:
+        for root, _, files in os.walk(directory):
+            for name in files:
+                if not name.endswith((".cpp", ".h", ".c", ".ino")):
+                    continue
+                with open(os.path.join(root, name), encoding="utf-8", errors="replace") as source:
+                    text = source.read()
+                for match in MODULE_PATTERN.finditer(text):
+                    module = unescape(match.group(1))
+                    modules[str(fnv1a(module))] = module
+                for match in FORMAT_PATTERN.finditer(text):
+                    format = "".join(unescape(l) for l in LITERAL_PATTERN.findall(match.group(1)))
+                    formats[str(fnv1a(format))] = format
+    return {"modules": modules, "formats": formats}
+
+
+def expand(format, payload):
+    """Expands a printf style format using arguments encoded by LogBroadcaster::logRecord"""
+    position = 0
+    output = []
+    last = 0
+    for match in CONVERSION_PATTERN.finditer(format):
+        output.append(format[last:match.start()])
+        last = match.end()
+        length, conversion = match.group(3), match.group(4)
+        if conversion == "%":
+            output.append("%")
+            continue
+        spec = match.group(0).replace(length or "", "", 1) if length else match.group(0)
+        try:
+            if conversion == "s":
+                count = payload[position]
+                value = payload[position + 1:position + 1 + count].decode("utf-8", "replace")
+                position += 1 + count
+            elif conversion in "fFeEgGaA":
+                value = struct.unpack_from("<d", payload, position)[0]
+                position += 8
+            elif length in ("ll", "j"):
+                value = struct.unpack_from("<q" if conversion in "di" else "<Q", payload, position)[0]
+                position += 8
+            else:
+                value = struct.unpack_from("<i" if conversion in "di" else "<I", payload, position)[0]
+                position += 4
+                if conversion == "c":
+                    value = chr(value & 0xFF)
+                elif conversion == "p":
+                    spec, value = "%s", "0x%08x" % value
+        except (IndexError, struct.error):
+            output.append("<truncated>")
+            break
+        output.append(spec % value)
+    else:
+        output.append(format[last:])
+    return "".join(output)
+
+
+def unwrap(text):
+    """Joins the base64 log batches carried by the "logbin" events in a capture of the /live stream"""
+    data = bytearray()
+    event = None
+    for line in text.splitlines():
+        line = line.strip()
+        if line.startswith(b"event:"):
+            event = line[6:].strip()
+        elif line.startswith(b"data:") and event == b"logbin":
+            try:
+                data += base64.b64decode(line[5:].strip(), validate=True)
+            except (binascii.Error, ValueError):
+                pass
+        elif not line:
+            # Blank line ends the event
+            event = None
+    return bytes(data)
+
+
+def decode(data, table, out):
+    """Writes the log to out, expanding binary records and passing plain text through"""
+    modules = table["modules"]
+    formats = table["formats"]
+    index = 0
+    while index < len(data):
+        start = data.find(MARKER, index)
+        if start < 0:
+            out.write(data[index:].decode("utf-8", "replace"))
+            break
+        out.write(data[index:start].decode("utf-8", "replace"))
+        if start + HEADER.size <= len(data):
+            _, level, size, module_id, format_id = HEADER.unpack_from(data, start)
+            format = formats.get(str(format_id))
+            # Only accept records with a known format so text that happens to contain the marker resynchronizes
+            if format is not None and level < len(LEVELS) and start + HEADER.size + size <= len(data):
+                payload = data[start + HEADER.size:start + HEADER.size + size]
+                module = modules.get(str(module_id), "%08x" % module_id)
+                out.write("[%s][%s] %s\n" % (LEVELS[level], module, expand(format, payload)))
+                index = start + HEADER.size + size
+                continue
+        out.write(data[start:start + 1].decode("utf-8", "replace"))
+        index = start + 1
+
+
+try:
+    Import("env")
+except NameError:
+    env = None
+
+if env is not None:
+    # Running as a PlatformIO extra script, regenerate the table for this build
+    project_dir = env.subst("$PROJECT_DIR")
+    build_dir = env.subst("$BUILD_DIR")
+    os.makedirs(build_dir, exist_ok=True)
+    table = scan_sources([os.path.join(project_dir, d) for d in ("lib", "src", "include")])
+    with open(os.path.join(build_dir, "log-formats.json"), "w") as output:
+        json.dump(table, output, indent="\t")
+elif __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Decodes binary Fabrica-IO logs")
+    parser.add_argument("log", nargs="?", help="captured log file, stdin if omitted")
+    parser.add_argument("--table", help="format table written by the build (log-formats.json)")
+    parser.add_argument("--source", action="append", help="source directory to scan for formats instead of a table")
+    parser.add_argument("--base64", action="store_true", help="input is a capture of the /live event stream")
+    args = parser.parse_args()
+    if args.table:
+        with open(args.table) as file:
+            table = json.load(file)
+    else:
+        here = os.path.dirname(os.path.abspath(__file__))
+        table = scan_sources(args.source or [os.path.join(here, d) for d in ("lib", "src", "include")])
+    if args.log:
+        with open(args.log, "rb") as file:
+            data = file.read()
+    else:
+        data = sys.stdin.buffer.read()
+    if args.base64:
+        data = unwrap(data)
+    decode(data, table, sys.stdout)
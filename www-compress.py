@@ -0,0 +1,202 @@
+#!/usr/bin/python3
+
+# Gzips the web interface in www/ so the hub can serve it compressed.
+#
+# As a PlatformIO pre script it writes the compressed files to ${PROJECT_DATA_DIR}/www, ready for "pio run -t uploadfs",
+# and generates www_assets.h in the build directory for builds with -DFABRICA_EMBED_WWW, which serve the web interface from flash.
+# From the command line it writes them wherever asked, to be uploaded to /www on the hub:
+#   python3 www-compress.py [--source DIR] [--out DIR] [--header FILE]
+# Files are compressed reproducibly (no name or time in the header) so unchanged contents keep the same bytes,
+# and the CRC-32 in each gzip trailer is used by the hub as the file's ETag.
+
+import argparse
+import gzip
+import os
+import shutil
+import zlib
+
+# Formats that are already compressed gain nothing from gzip
+STORED = (".png", ".jpg", ".jpeg", ".gif", ".ico", ".gz")
+
+# Content types sent for embedded files, by extension
+TYPES = {
+    ".html": "text/html", ".htm": "text/html", ".css": "text/css", ".js": "application/javascript",
+    ".json": "application/json", ".png": "image/png", ".jpg": "image/jpeg", ".jpeg": "image/jpeg",
+    ".gif": "image/gif", ".svg": "image/svg+xml", ".ico": "image/x-icon", ".txt": "text/plain", ".csv": "text/csv",
+}
+
+
+def fnv1a(text, seed):
+    """Hashes a path, must match WwwAssets::hash in the generated header"""
+    hash = 2166136261 ^ seed
+    for byte in text.encode("utf-8"):
+        hash = ((hash ^ byte) * 16777619) & 0xFFFFFFFF
+    return hash
+
+
+def perfect_hash(paths):
+    """Finds a seed that hashes every path to its own slot, returns the seed and the slot table"""
+    size = 1
+    while size < len(paths) * 2:
+        size *= 2
+    while True:
+        for seed in range(1, 100000):
+            slots = [-1] * size
+            for index, path in enumerate(paths):
+                slot = fnv1a(path, seed) & (size - 1)
+                if slots[slot] >= 0:
+                    break
+                slots[slot] = index
+            else:
+                return seed, slots
+        size *= 2
+
+
+def embed(source, header):
+    """Writes a header holding every file in source, gzipped where it helps, with a perfect hash table of their paths"""
+    assets = []
+    for root, _, files in os.walk(source):
+        for name in sorted(files):
+            path = os.path.join(root, name)
+            with open(path, "rb") as file:
+                data = file.read()
+            extension = os.path.splitext(name)[1].lower()
+            packed = name.lower().endswith(STORED)
+            assets.append({
+                "path": "/" + os.path.relpath(path, source).replace(os.sep, "/"),
+                "type": TYPES.get(extension, "application/octet-stream"),
+                "data": data if packed else gzip.compress(data, compresslevel=9, mtime=0),
+                "gzip": not packed,
+                "crc": zlib.crc32(data) & 0xFFFFFFFF,
+                "length": len(data),
+            })
+    seed, slots = perfect_hash([asset["path"] for asset in assets])
+    lines = [
+        "// Generated by www-compress.py from %s, do not edit" % os.path.basename(os.path.abspath(source)),
+        "#pragma once",
+        "#include <stdint.h>",
+        "#include <string.h>",
+        "",
+        "namespace WwwAssets {",
+        "	/// @brief A web file compiled into the firmware",
+        "	struct Asset {",
+        "		/// @brief The URL path of the file",
+        "		const char* path;",
+        "",
+        "		/// @brief The content type of the file",
+        "		const char* type;",
+        "",
+        "		/// @brief The contents as sent",
+        "		const uint8_t* data;",
+        "",
+        "		/// @brief The size of the contents as sent",
+        "		uint32_t size;",
+        "",
+        "		/// @brief CRC-32 of the uncompressed contents",
+        "		uint32_t crc;",
+        "",
+        "		/// @brief Length of the uncompressed contents",
+        "		uint32_t length;",
+        "",
+        "		/// @brief True if the contents are gzipped",
+        "		bool gzip;",
+        "	};",
+        "",
+    ]
+    for index, asset in enumerate(assets):
+        data = asset["data"]
+        lines.append("	static constexpr uint8_t data%d[] = {" % index)
+        for start in range(0, len(data), 24):
+            lines.append("		" + ", ".join("0x%02x" % byte for byte in data[start:start + 24]) + ",")
+        lines.append("	};")
+    lines.append("")
+    lines.append("	static constexpr Asset assets[] = {")
+    for index, asset in enumerate(assets):
+        lines.append('		{ "%s", "%s", data%d, sizeof(data%d), 0x%08x, %d, %s },' % (asset["path"], asset["type"], index, index, asset["crc"], asset["length"], "true" if asset["gzip"] else "false"))
+    lines += [
+        "	};",
+        "",
+        "	/// @brief Seed that gives every path its own slot",
+        "	static constexpr uint32_t seed = %d;" % seed,
+        "",
+        "	/// @brief Index into assets for each hash slot, -1 if empty",
+        "	static constexpr int16_t slots[] = { %s };" % ", ".join(str(slot) for slot in slots),
+        "",
+        "	/// @brief Hashes a path to its slot",
+        "	/// @param path The path",
+        "	/// @return The slot",
+        "	inline uint32_t hash(const char* path) {",
+        "		uint32_t hash = 2166136261u ^ seed;",
+        "		for (; *path != '\\0'; path++) {",
+        "			hash = (hash ^ static_cast<uint8_t>(*path)) * 16777619u;",
+        "		}",
+        "		return hash & (sizeof(slots) / sizeof(slots[0]) - 1);",
+        "	}",
+        "",
+        "	/// @brief Finds a file by path with a single hash and compare",
+        "	/// @param path The URL path of the file",
+        "	/// @return The file, or nullptr if it isn't embedded",
+        "	inline const Asset* find(const char* path) {",
+        "		int16_t index = slots[hash(path)];",
+        "		return index >= 0 && strcmp(assets[index].path, path) == 0 ? &assets[index] : nullptr;",
+        "	}",
+        "}",
+        "",
+    ]
+    os.makedirs(os.path.dirname(os.path.abspath(header)), exist_ok=True)
+    with open(header, "w") as file:
+        file.write("\n".join(lines))
+    return len(assets)
+
+
+def compress(source, out):
+    """Writes a gzipped copy of every file in source to out, returns the total bytes before and after"""
+    before = 0
+    after = 0
+    for root, _, files in os.walk(source):
+        for name in sorted(files):
+            path = os.path.join(root, name)
+            target = os.path.join(out, os.path.relpath(path, source))
+            os.makedirs(os.path.dirname(target), exist_ok=True)
+            with open(path, "rb") as file:
+                data = file.read()
+            before += len(data)
+            if name.lower().endswith(STORED):
+                shutil.copyfile(path, target)
+                after += len(data)
+                continue
+            # Remove an uncompressed copy left by an earlier build, the hub would serve it to browsers without gzip
+            if os.path.exists(target):
+                os.remove(target)
+            packed = gzip.compress(data, compresslevel=9, mtime=0)
+            with open(target + ".gz", "wb") as file:
+                file.write(packed)
+            after += len(packed)
+    return before, after
+
+
+try:
+    Import("env")
+except NameError:
+    env = None
+
+if env is not None:
+    # Running as a PlatformIO extra script, refresh the file system image contents
+    project_dir = env.subst("$PROJECT_DIR")
+    before, after = compress(os.path.join(project_dir, "www"), os.path.join(env.subst("$PROJECT_DATA_DIR"), "www"))
+    print("Web interface compressed from %d to %d bytes" % (before, after))
+    # Included by the web server when built with -DFABRICA_EMBED_WWW
+    generated = os.path.join(env.subst("$BUILD_DIR"), "generated")
+    embed(os.path.join(project_dir, "www"), os.path.join(generated, "www_assets.h"))
+    env.Append(CPPPATH=[generated])
+elif __name__ == "__main__":
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description="Gzips the Fabrica-IO web interface")
+    parser.add_argument("--source", default=os.path.join(here, "www"), help="directory of web files, www/ if omitted")
+    parser.add_argument("--out", default=os.path.join(here, "data", "www"), help="directory to write to, data/www/ if omitted")
+    parser.add_argument("--header", help="also generate the header for -DFABRICA_EMBED_WWW builds")
+    args = parser.parse_args()
+    before, after = compress(args.source, args.out)
+    print("Web interface compressed from %d to %d bytes" % (before, after))
+    if args.header:
+        print("Embedded %d files in %s" % (embed(args.source, args.header), args.header))
\ No newline at end of file